@@ -0,0 +1,27 @@
+# Reihenfolge nach kritischem Pfad
+#
+# Während b0 läuft, warten s1 und c1. Ohne gespeicherte Laufzeiten zählt die Tiefe: c1 und c2
+# liegen auf dem längeren Pfad und laufen vor s1, obwohl s1 zuerst genannt ist.
+
+all:: b0 s1 c3
+
+c3:: c2
+    echo "Xx:$(0)"
+
+c2:: c1
+    echo "Xx:$(0)"
+
+b0::
+    sleep 0.3 2>/dev/null || sleep 1
+    echo "Xx:$(0)"
+
+%::
+    echo "Xx:$(0)"
+
+#PARALLEL:1
+#STDOUT:Xx:b0
+#STDOUT:Xx:c1
+#STDOUT:Xx:c2
+#STDOUT:Xx:s1
+#STDOUT:Xx:c3
+#STDOUT:Xx:all
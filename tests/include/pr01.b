@@ -0,0 +1,9 @@
+# Unterbuild für Testfall pr01: Fortschrittsanzeige abgeschaltet.
+!settings
+   progress=false
+
+all:: a.x b.x
+
+%.x::
+    sleep 1
+    echo "Yy:$(0)"
@@ -0,0 +1,75 @@
+# Hilfsfunktionen für Testfälle mit yabusrv (mit «. tests/include/sv.sh» einlesen).
+#
+#   sv_init DIR          Verzeichnis mit yabu.cfg und Anmelde-Tokens anlegen
+#   sv_host NAME ARGS    Server «NAME» in yabu.cfg eintragen (eigener Port)
+#   sv_start NAME        Server «NAME» starten und warten, bis er Verbindungen annimmt
+#   sv_stop NAME [SIG]   Server «NAME» beenden
+#   sv_yabu ARGS         yabu mit diesem Verzeichnis (oder «$sv_g») als Konfiguration aufrufen
+#                        (höchstens 120s)
+#   sv_done              Alle Server beenden, Verzeichnis löschen
+#
+# yabusrv nimmt keine Anmeldung mit UID < 20 an. Als root läuft yabu (und damit jedes Skript auf
+# dem Server) deshalb als «nobody». Geht das nicht, gibt «sv_init» «Xx:SKIPPED» aus und liefert 1.
+
+sv_init()
+{
+   sv_d=$1
+   sv_g=$1
+   sv_port=`expr 20000 + $$ % 20000`
+   sv_as=
+   if [ `id -u` -lt 20 ]; then
+      if ! su -s /bin/sh -c true nobody >/dev/null 2>&1; then
+         echo "Xx:SKIPPED cannot run yabu as nobody"
+         return 1
+      fi
+      sv_as=nobody
+   fi
+   rm -rf $sv_d
+   mkdir $sv_d $sv_d/auth
+   chmod 777 $sv_d
+   chmod 1777 $sv_d/auth
+   ln -s ../../yabu $sv_d/yabusrv
+   echo "!servers" >$sv_d/yabu.cfg
+}
+
+sv_host()
+{
+   sv_name=$1
+   shift
+   echo "host $sv_name:127.0.0.1:$sv_port $*" >>$sv_d/yabu.cfg
+   sv_port=`expr $sv_port + 1`
+}
+
+sv_start()
+{
+   YABU_FAKE_HOSTNAME=$1 $sv_d/yabusrv -v -g $sv_d >>$sv_d/$1.log 2>&1 &
+   echo $! >$sv_d/$1.pid
+   sv_n=0
+   until grep "listening" $sv_d/$1.log >/dev/null || [ $sv_n -ge 50 ]; do
+      sleep 0.1
+      sv_n=`expr $sv_n + 1`
+   done
+}
+
+sv_stop()
+{
+   [ -f $sv_d/$1.pid ] && kill -${2:-TERM} `cat $sv_d/$1.pid` 2>/dev/null
+   rm -f $sv_d/$1.pid
+}
+
+sv_yabu()
+{
+   if [ -n "$sv_as" ]; then
+      timeout 120 su -s /bin/sh -c "./yabu -g $sv_g $*" $sv_as
+   else
+      timeout 120 ./yabu -g $sv_g "$@"
+   fi
+}
+
+sv_done()
+{
+   for sv_p in $sv_d/*.pid; do
+      [ -f $sv_p ] && kill `cat $sv_p` 2>/dev/null
+   done
+   rm -rf $sv_d
+}
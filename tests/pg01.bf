@@ -0,0 +1,17 @@
+# Abbruch nach einem Fehler (-k): Laufende Skripte werden samt ihrer Kindprozesse sofort beendet,
+# nicht erst nach ihrem Ende.
+
+all:: fail slow
+
+fail::
+    sleep 1
+    echo "Xx:fail"
+    false
+
+slow::
+    (sleep 5; echo "X""x:late"); echo "X""x:slow"
+
+#PARALLEL:2
+#INVOKE:-k
+#SHOULD_FAIL:G30
+#STDOUT:Xx:fail
@@ -0,0 +1,19 @@
+# Anzahl lokaler Jobs (-l)
+#
+# a.test wartet, bis b.test gelaufen ist. Das funktioniert nur, wenn beide Skripte gleichzeitig
+# ausgeführt werden.
+
+all:: a.test b.test
+
+a.test::
+    i=0; while [ ! -f tests/pj01.tmp ]; do sleep 1; i=`expr $i + 1`; [ $i -lt 10 ] || exit 1; done
+    rm -f tests/pj01.tmp
+    echo "Xx:a"
+
+b.test::
+    touch tests/pj01.tmp
+    echo "Xx:b"
+
+#INVOKE:-l 2
+#STDOUT:Xx:b
+#STDOUT:Xx:a
@@ -0,0 +1,11 @@
+# Jobserver für Unter-Builds: Mit «jobserver_create» exportiert yabu bei parallelem Build
+# MAKEFLAGS mit --jobserver-auth an lokale Skripte.
+
+!settings
+   jobserver_create=true
+
+all::
+    echo "Xx:$MAKEFLAGS" | sed -e 's/[0-9][0-9]*,[0-9][0-9]*/R,W/'
+
+#INVOKE:-l 3
+#STDOUT:Xx:-j3 --jobserver-auth=R,W
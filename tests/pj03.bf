@@ -0,0 +1,7 @@
+# Ohne «jobserver_create» und ohne Jobserver von make bleibt MAKEFLAGS unverändert.
+
+all::
+    echo "Xx:$MAKEFLAGS"
+
+#INVOKE:-l 3
+#STDOUT:Xx:
@@ -0,0 +1,16 @@
+# Eigener Jobserver: Ändert sich «local_jobs» während des Builds, erhalten danach gestartete
+# Skripte das neue -jN in MAKEFLAGS.
+
+all::
+    {
+      rm -rf tests/pj04.d
+      mkdir tests/pj04.d
+      printf '!settings\nlocal_jobs=2\n' >tests/pj04.d/yabu.cfg
+      ./yabu -g tests/pj04.d -s -f tests/include/pj04.a >tests/pj04.d/out 2>&1 && echo "Xx:ok"
+      grep "Yy:" tests/pj04.d/out | sed -e 's/^Yy/Xx/'
+      rm -rf tests/pj04.d
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:a -j2 --jobserver-auth=R,W
+#STDOUT:Xx:b -j4 --jobserver-auth=R,W
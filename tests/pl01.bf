@@ -0,0 +1,21 @@
+# Verwendung von !pool
+#
+# Die Kapazität reicht nur für ein Ziel mit Gewicht 2, d.h. die Skripte laufen nacheinander.
+
+!pool mem 3
+   2: %.big
+
+all:: 1.big 2.big 3.big
+
+%.big::
+    echo "Xx:$(0) begin"
+    sleep 0.2 2>/dev/null || sleep 1
+    echo "Xx:$(0) end"
+
+#PARALLEL:4
+#STDOUT:Xx:1.big begin
+#STDOUT:Xx:1.big end
+#STDOUT:Xx:2.big begin
+#STDOUT:Xx:2.big end
+#STDOUT:Xx:3.big begin
+#STDOUT:Xx:3.big end
@@ -0,0 +1,9 @@
+# !pool: Syntaxfehler im Gewicht
+
+!pool mem 3
+   2x: %.big
+
+all::
+    echo "Xx:nicht erreicht"
+
+#SHOULD_FAIL:S01
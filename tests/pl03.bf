@@ -0,0 +1,18 @@
+# !pool: Ziele, die mit einer Ziffer beginnen, brauchen kein Gewicht. Bei Kapazität 1 laufen die
+# Skripte nacheinander.
+
+!pool mem 1
+   2nd.big 3rd.big
+
+all:: 2nd.big 3rd.big
+
+%.big::
+    echo "Xx:$(0) begin"
+    sleep 0.2 2>/dev/null || sleep 1
+    echo "Xx:$(0) end"
+
+#PARALLEL:4
+#STDOUT:Xx:2nd.big begin
+#STDOUT:Xx:2nd.big end
+#STDOUT:Xx:3rd.big begin
+#STDOUT:Xx:3rd.big end
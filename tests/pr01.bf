@@ -0,0 +1,31 @@
+# Fortschrittsanzeige auf einem Terminal (über script(1)). Sie erscheint ohne weitere Einstellungen,
+# Ausgaben der Skripte (auch auf stderr) beginnen immer auf einer gelöschten Zeile, die Gesamtzahl
+# bleibt konstant. Mit «progress=false» erscheint keine Fortschrittszeile.
+
+all::
+    {
+      if script -qec true /dev/null >/dev/null 2>&1; then
+         esc=`printf '\033'`
+         script -qec "./yabu -s -f tests/include/pr01.a" /dev/null | tr -d '\r' >tests/pr01.tmp
+         grep "ETA" tests/pr01.tmp >/dev/null && echo "Xx:progress shown"
+         sed -e "s/.*$esc\[K//" tests/pr01.tmp | grep "Yy:" | sort | sed -e 's/^Yy/Xx/'
+         n=`grep -o '\[[0-9]*/[0-9]*\]' tests/pr01.tmp | sed -e 's,.*/,,' | sort -u | wc -l`
+         [ $n -eq 1 ] && echo "Xx:total constant"
+         script -qec "./yabu -s -f tests/include/pr01.b" /dev/null | tr -d '\r' >tests/pr01.tmp
+         grep "ETA" tests/pr01.tmp >/dev/null || echo "Xx:no progress"
+         grep "Yy:" tests/pr01.tmp | sort | sed -e 's/^Yy/Xx/'
+         rm -f tests/pr01.tmp
+      else
+         echo "Xx:SKIPPED script(1) not available"
+      fi
+    }
+
+#STDOUT:Xx:progress shown
+#STDOUT:Xx:a.x
+#STDOUT:Xx:a.x err
+#STDOUT:Xx:b.x
+#STDOUT:Xx:b.x err
+#STDOUT:Xx:total constant
+#STDOUT:Xx:no progress
+#STDOUT:Xx:a.x
+#STDOUT:Xx:b.x
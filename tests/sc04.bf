@@ -0,0 +1,13 @@
+# Skripte mit '#!' (eigene Shell). Der Rest des Skriptes wird über eine anonyme Datei bzw. eine
+# temporäre Datei an die Shell übergeben.
+
+all:
+  #!/bin/sh
+  for x in 1 2; do
+    echo "Xx:$x"
+  done
+  [ -r "$0" ] && echo "Xx:readable"
+
+#STDOUT:Xx:1
+#STDOUT:Xx:2
+#STDOUT:Xx:readable
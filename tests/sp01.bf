@@ -0,0 +1,15 @@
+# Spekulative Ausführung mit !nospeculate
+#
+# Ohne Server gibt es keine zweite Warteschlange, d.h. jedes Skript läuft genau einmal.
+
+!settings
+   speculate=1
+!nospeculate %.once
+
+all:: 1.once 2.twice
+
+%.once %.twice::
+    echo "Xx:$(0)"
+
+#STDOUT:Xx:1.once
+#STDOUT:Xx:2.twice
@@ -0,0 +1,26 @@
+# Spekulative Ausführung mit einem Server: der erste Lauf ermittelt die Laufzeit, im zweiten hängt
+# die erste Kopie, die spekulative Kopie auf der anderen Warteschlange gewinnt. Die Ausgabe
+# erscheint einmal, das Ziel wird einmal erzeugt, die verlorene Kopie wird abgebrochen.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sp02.d || exit 0
+      echo "host `hostname` max=1" >>$sv_d/yabu.cfg
+      sv_host sp02 max=1
+      sv_start sp02
+      cp tests/include/sp02.a $sv_d		# Statusdatei im beschreibbaren Verzeichnis
+      sv_yabu -f $sv_d/sp02.a >$sv_d/out1 2>&1 || echo "Xx:first build failed"
+      touch $sv_d/phase2
+      rm -f $sv_d/count
+      sv_yabu -f $sv_d/sp02.a >$sv_d/out 2>&1 && echo "Xx:ok"
+      grep "Yy:" $sv_d/out | sed -e 's/^Yy/Xx/'
+      grep "speculative" $sv_d/out >/dev/null && echo "Xx:speculative"
+      echo "Xx:built `grep -c . $sv_d/count`"
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:t
+#STDOUT:Xx:speculative
+#STDOUT:Xx:built 1
@@ -0,0 +1,26 @@
+# Verbindungsabbruch während des Builds: der einzige Server fällt aus und wird neu gestartet. Die
+# laufenden und wartenden Skripte behalten den Server und laufen nach dem erneuten Verbinden dort.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv01.d || exit 0
+      sv_host sv01 max=2
+      sv_start sv01
+      sv_yabu -s -f tests/include/sv01.a >$sv_d/out 2>&1 &
+      cli=$!
+      n=0
+      while [ ! -f $sv_d/started ] && [ $n -lt 100 ]; do sleep 0.1; n=`expr $n + 1`; done
+      sv_stop sv01 KILL
+      sleep 0.5
+      sv_start sv01
+      wait $cli && echo "Xx:ok"
+      grep "Yy:" $sv_d/out | sort | sed -e 's/^Yy/Xx/'
+      grep "lost connection" $sv_d/out >/dev/null && echo "Xx:restarted"
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:a
+#STDOUT:Xx:b
+#STDOUT:Xx:restarted
@@ -0,0 +1,25 @@
+# Verbindungsabbruch mit zwei Servern: der Server, auf dem das Skript läuft, fällt aus. Das Skript
+# startet sofort auf dem anderen, bis dahin untätigen Server neu.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv02.d || exit 0
+      sv_host sv02a max=1 prio=5
+      sv_host sv02b max=1 prio=1
+      sv_start sv02a
+      sv_start sv02b
+      sv_yabu -s -f tests/include/sv02.a >$sv_d/out 2>&1 &
+      cli=$!
+      n=0
+      while [ ! -f $sv_d/started ] && [ $n -lt 100 ]; do sleep 0.1; n=`expr $n + 1`; done
+      sv_stop sv02a KILL
+      wait $cli && echo "Xx:ok"
+      grep "Yy:" $sv_d/out | sed -e 's/^Yy/Xx/'
+      grep "Building y @sv02b" $sv_d/out >/dev/null && echo "Xx:restarted on sv02b"
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:y
+#STDOUT:Xx:restarted on sv02b
@@ -0,0 +1,38 @@
+# Server-Liste während des Builds ändern: sv03b kommt hinzu, sv03a fällt weg. Die neue Adresse
+# ist noch nicht aufgelöst, sie kommt erst über den Kindprozeß von «cfg_resolve_async()» dazu.
+# Das laufende Skript auf sv03a läuft zu Ende, alle weiteren laufen auf sv03b. Die Server lesen
+# ihre yabu.cfg ebenfalls neu, deshalb hat yabu eine eigene.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv03.d || exit 0
+      sv_host sv03a max=1
+      sv_host sv03b max=1
+      sv_start sv03a
+      sv_start sv03b
+      sv_g=$sv_d/cli
+      mkdir $sv_g
+      ln -s ../auth $sv_g/auth
+      grep -v sv03b $sv_d/yabu.cfg >$sv_g/yabu.cfg
+      sv_yabu -s -P -f tests/include/sv03.a >$sv_d/out 2>&1 &
+      cli=$!
+      n=0
+      while [ ! -f $sv_d/started ] && [ $n -lt 100 ]; do sleep 0.1; n=`expr $n + 1`; done
+      sleep 1
+      grep -v sv03a $sv_d/yabu.cfg >$sv_g/yabu.cfg
+      wait $cli && echo "Xx:ok"
+      grep "Yy:" $sv_d/out | sed -e 's/^Yy/Xx/'
+      grep "Building a @sv03a" $sv_d/out >/dev/null && echo "Xx:a on sv03a"
+      grep "Building b @sv03b" $sv_d/out >/dev/null && echo "Xx:b on sv03b"
+      grep "Building c @sv03b" $sv_d/out >/dev/null && echo "Xx:c on sv03b"
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:b
+#STDOUT:Xx:a
+#STDOUT:Xx:c
+#STDOUT:Xx:a on sv03a
+#STDOUT:Xx:b on sv03b
+#STDOUT:Xx:c on sv03b
@@ -0,0 +1,26 @@
+# Kleine Builds («small=» in !users): Die Größe meldet yabu dem Server ('N'). Der kleine Build
+# läuft mit «smallnice=», der große von Anfang an mit «nice=».
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv04.d || exit 0
+      sv_host sv04 max=1
+      printf '!users\n* nice=10 small=4 smallnice=3\n' >>$sv_d/yabu.cfg
+      sv_start sv04
+      sv_yabu -s -f tests/include/sv04.a small >$sv_d/out 2>&1 && echo "Xx:ok"
+      sv_yabu -s -f tests/include/sv04.a large >>$sv_d/out 2>&1 && echo "Xx:ok"
+      grep "Yy:" $sv_d/out | sed -e 's/^Yy/Xx/'
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:ok
+#STDOUT:Xx:s1 3
+#STDOUT:Xx:s2 3
+#STDOUT:Xx:l1 10
+#STDOUT:Xx:l2 10
+#STDOUT:Xx:l3 10
+#STDOUT:Xx:l4 10
+#STDOUT:Xx:l5 10
+#STDOUT:Xx:l6 10
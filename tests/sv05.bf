@@ -0,0 +1,19 @@
+# Alle Blöcke eines Skripts auf einmal ('B'): Scheitert der zweite Block, führt der Server den
+# dritten nicht mehr aus.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv05.d || exit 0
+      sv_host sv05
+      sv_start sv05
+      sv_yabu -s -K -P -f tests/include/sv05.a >$sv_d/out 2>&1 || echo "Xx:failed"
+      grep "Yy:" $sv_d/out | sed -e 's/^Yy/Xx/'
+      grep "Building x @sv05" $sv_d/out >/dev/null && echo "Xx:x on sv05"
+      [ -f $sv_d/chunk3 ] && echo "Xx:chunk 3 ran"
+      sv_done
+    }
+
+#STDOUT:Xx:failed
+#STDOUT:Xx:1
+#STDOUT:Xx:x on sv05
@@ -0,0 +1,36 @@
+# Protokollversionen: Gegenüber einem Server mit altem Protokoll (ohne Version, simuliert mit
+# YABU_FAKE_PROTO) fällt yabu auf das alte Format zurück. Mit beiden Versionen kommen mehr als
+# 16 MB Ausgabe eines Skripts vollständig an.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv06.d || exit 0
+      sv_host sv06new
+      sv_host sv06old
+      sv_start sv06new
+      YABU_FAKE_PROTO=0
+      export YABU_FAKE_PROTO
+      sv_start sv06old
+      unset YABU_FAKE_PROTO
+      for v in new old; do
+	 sv_g=$sv_d/$v
+	 mkdir $sv_g
+	 ln -s ../auth $sv_g/auth
+	 { echo '!servers'; grep "host sv06$v:" $sv_d/yabu.cfg; } >$sv_g/yabu.cfg
+	 sv_yabu -s -f tests/include/sv06.a >$sv_d/$v.out 2>&1 && echo "Xx:$v ok"
+	 grep "Building x @sv06$v" $sv_d/$v.out >/dev/null && echo "Xx:$v on sv06$v"
+	 echo "Xx:$v" `grep -c '^Yy:0123456789abcdef$' $sv_d/$v.out` `grep -c '^Yy:done$' $sv_d/$v.out`
+	 echo "Xx:$v old protocol" `grep -c "protocol 0$" $sv_d/sv06$v.log`
+      done
+      sv_done
+    }
+
+#STDOUT:Xx:new ok
+#STDOUT:Xx:new on sv06new
+#STDOUT:Xx:new 1000000 1
+#STDOUT:Xx:new old protocol 0
+#STDOUT:Xx:old ok
+#STDOUT:Xx:old on sv06old
+#STDOUT:Xx:old 1000000 1
+#STDOUT:Xx:old old protocol 1
@@ -0,0 +1,34 @@
+# Environment auf dem Server: eine Kopie je Verbindung ('S') plus Abweichungen je Skript ('E').
+# Beide Skripte laufen nacheinander über dieselbe Verbindung. Zum Vergleich dasselbe mit einem
+# Server, der nur Protokollversion 2 kennt und das ganze Environment je Skript erhält.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv07.d || exit 0
+      sv_host sv07new max=1
+      sv_host sv07old max=1
+      sv_start sv07new
+      YABU_FAKE_PROTO=2
+      export YABU_FAKE_PROTO
+      sv_start sv07old
+      unset YABU_FAKE_PROTO
+      for v in new old; do
+	 sv_g=$sv_d/$v
+	 mkdir $sv_g
+	 ln -s ../auth $sv_g/auth
+	 { echo '!servers'; grep "host sv07$v:" $sv_d/yabu.cfg; } >$sv_g/yabu.cfg
+	 sv_yabu -s -f tests/include/sv07.a >$sv_d/$v.out 2>&1 && echo "Xx:$v ok"
+	 grep "Yy:" $sv_d/$v.out | sed -e "s/^Yy:/Xx:$v /"
+	 grep "protocol 2$" $sv_d/sv07$v.log >/dev/null && echo "Xx:$v protocol 2"
+      done
+      sv_done
+    }
+
+#STDOUT:Xx:new ok
+#STDOUT:Xx:new echo.gross fest EINS/zwei [x] -_local+gross
+#STDOUT:Xx:new echo.klein fest eins/zwei [] -_local+klein
+#STDOUT:Xx:old ok
+#STDOUT:Xx:old echo.gross fest EINS/zwei [x] -_local+gross
+#STDOUT:Xx:old echo.klein fest eins/zwei [] -_local+klein
+#STDOUT:Xx:old protocol 2
@@ -0,0 +1,32 @@
+# Gegendruck: Nimmt yabu keine Daten ab (hier mit SIGSTOP), liest der Server die Ausgabe des
+# Skripts nicht weiter. Das Skript blockiert, statt 50 MB im Server zu puffern. Nach SIGCONT
+# kommt die Ausgabe vollständig an.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv08.d || exit 0
+      sv_host sv08
+      sv_start sv08
+      sv_yabu -s -P -f tests/include/sv08.a >$sv_d/out 2>&1 &
+      cli=$!
+      n=0
+      while [ ! -f $sv_d/started ] && [ $n -lt 100 ]; do sleep 0.1; n=`expr $n + 1`; done
+      kill -STOP `cat $sv_d/client.pid`
+      sleep 3
+      [ -f $sv_d/written ] || echo "Xx:blocked"
+      srv=`cat $sv_d/sv08.pid`
+      rss=`grep VmRSS /proc/$srv/status | tr -dc 0-9`
+      [ $rss -lt 30000 ] && echo "Xx:bounded"
+      kill -CONT `cat $sv_d/client.pid`
+      wait $cli && echo "Xx:ok"
+      echo "Xx:" `grep -c '^Yy:0123456789abcdef$' $sv_d/out`
+      [ -f $sv_d/written ] && echo "Xx:written"
+      sv_done
+    }
+
+#STDOUT:Xx:blocked
+#STDOUT:Xx:bounded
+#STDOUT:Xx:ok
+#STDOUT:Xx: 2500000
+#STDOUT:Xx:written
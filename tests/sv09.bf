@@ -0,0 +1,25 @@
+# Freie Plätze ('L'): Laut yabu.cfg des Clients hat sv09a vier Plätze, der Server selbst hat nur
+# einen und meldet das. yabu schickt ihm deshalb trotz höherer Priorität nur ein Skript und die
+# übrigen an sv09b, statt sie bei sv09a warten zu lassen.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv09.d || exit 0
+      sv_host sv09a max=1 prio=5
+      sv_host sv09b max=4 prio=1
+      sv_start sv09a
+      sv_start sv09b
+      sv_g=$sv_d/cli
+      mkdir $sv_g
+      ln -s ../auth $sv_g/auth
+      sed -e 's/max=1/max=4/' $sv_d/yabu.cfg >$sv_g/yabu.cfg
+      sv_yabu -s -P -f tests/include/sv09.a >$sv_d/out 2>&1 && echo "Xx:ok"
+      echo "Xx:sv09a" `grep -c "^Building t[0-9] @sv09a" $sv_d/out`
+      echo "Xx:sv09b" `grep -c "^Building t[0-9] @sv09b" $sv_d/out`
+      sv_done
+    }
+
+#STDOUT:Xx:ok
+#STDOUT:Xx:sv09a 1
+#STDOUT:Xx:sv09b 3
@@ -0,0 +1,31 @@
+# Höchstzahl je Benutzer («max=» in !users): Der Server hat vier Plätze, ein Benutzer darf aber nur
+# ein Skript gleichzeitig laufen lassen. Mit 'L' schickt yabu gar nicht mehr; ein Client mit altem
+# Protokoll (YABU_FAKE_PROTO) schickt alle vier, und der Server startet sie nacheinander.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv10.d || exit 0
+      sv_host sv10new max=4
+      sv_host sv10old max=4
+      printf '!users\n* max=1\n' >>$sv_d/yabu.cfg
+      sv_start sv10new
+      YABU_FAKE_PROTO=4
+      export YABU_FAKE_PROTO
+      sv_start sv10old
+      unset YABU_FAKE_PROTO
+      for v in new old; do
+	 sv_g=$sv_d/$v
+	 mkdir $sv_g
+	 ln -s ../auth $sv_g/auth
+	 { echo '!servers'; grep "host sv10$v:" $sv_d/yabu.cfg; } >$sv_g/yabu.cfg
+	 sv_yabu -s -f tests/include/sv10.a >$sv_d/$v.out 2>&1 && echo "Xx:$v ok"
+	 echo "Xx:$v" `grep -c "^Building x[0-9] @sv10$v" $sv_d/$v.out` `grep -c "^Yy:overlap" $sv_d/$v.out`
+      done
+      sv_done
+    }
+
+#STDOUT:Xx:new ok
+#STDOUT:Xx:new 4 0
+#STDOUT:Xx:old ok
+#STDOUT:Xx:old 4 0
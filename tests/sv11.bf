@@ -0,0 +1,66 @@
+# Anteile («share=» in !users): Zwei Benutzer teilen sich vier Plätze, der zweite mit dreifachem
+# Anteil. Zuerst belegt «nobody» alle Plätze, dann schickt der zweite Benutzer seine Skripte. Von
+# den vier Plätzen, die danach frei werden, muß er drei bekommen. Beide Clients benutzen das alte
+# Protokoll (YABU_FAKE_PROTO), schicken also alle Skripte sofort, und die Auswahl trifft der Server.
+# Braucht root und einen zweiten Benutzer.
+
+all::
+    {
+      . tests/include/sv.sh
+      sv_init tests/sv11.d || exit 0
+      sv_u2=
+      if [ -n "$sv_as" ]; then
+	 for u in `awk -F: '$3 >= 20 && $1 != "nobody" { print $1 }' /etc/passwd`; do
+	    if su -s /bin/sh -c "test -x ./yabu && test -w $sv_d" $u >/dev/null 2>&1; then
+	       sv_u2=$u
+	       break
+	    fi
+	 done
+      fi
+      if [ -z "$sv_u2" ]; then
+	 echo "Xx:SKIPPED needs root and a second user"
+	 sv_done
+	 exit 0
+      fi
+      sv_host sv11 max=4
+      printf '!users\nnobody share=1\n%s share=3\n' $sv_u2 >>$sv_d/yabu.cfg
+      YABU_FAKE_PROTO=4
+      export YABU_FAKE_PROTO
+      sv_start sv11
+      unset YABU_FAKE_PROTO
+      sv_g=$sv_d/cli
+      mkdir $sv_g
+      ln -s ../auth $sv_g/auth
+      sed -e 's/max=4/max=12/' $sv_d/yabu.cfg >$sv_g/yabu.cfg
+      : >$sv_d/log
+      chmod 666 $sv_d/log
+      sv_yabu -s -f tests/include/sv11.a b >$sv_d/b.out 2>&1 &
+      pid_b=$!
+      n=0
+      until [ `ls $sv_d | grep -c '^wait\.'` -ge 4 ] || [ $n -ge 100 ]; do
+	 sleep 0.1
+	 n=`expr $n + 1`
+      done
+      sv_as=$sv_u2
+      sv_yabu -s -f tests/include/sv11.a a >$sv_d/a.out 2>&1 &
+      pid_a=$!
+      sv_as=nobody
+      n=0
+      until [ `grep -c "protocol" $sv_d/sv11.log` -ge 2 ] || [ $n -ge 100 ]; do
+	 sleep 0.1
+	 n=`expr $n + 1`
+      done
+      sleep 1
+      touch $sv_d/go
+      wait $pid_b $pid_a
+      echo "Xx:nobody" `grep -c "^Building x-b[0-9]* @sv11" $sv_d/b.out`
+      echo "Xx:second" `grep -c "^Building x-a[0-9]* @sv11" $sv_d/a.out`
+      echo "Xx:" `sed -n -e '1,4s/[0-9]*$//p' $sv_d/log | sort`
+      echo "Xx:" `sed -n -e '5,8s/[0-9]*$//p' $sv_d/log | sort`
+      sv_done
+    }
+
+#STDOUT:Xx:nobody 12
+#STDOUT:Xx:second 8
+#STDOUT:Xx: b b b b
+#STDOUT:Xx: a a a b
@@ -0,0 +1,22 @@
+# Skripte auf einem Terminal (über script(1)): Ein Skript, das von stdin liest, bekommt /dev/null
+# statt SIGTTIN, yabu bleibt also nicht hängen. Bricht yabu ab, beendet es auch die von den Skripten
+# gestarteten Programme (eigene Prozeßgruppe).
+
+all::
+    {
+      if script -qec true /dev/null >/dev/null 2>&1; then
+         rm -f tests/tt01.pid
+         (sleep 1; echo hello) | timeout 30 script -qec "./yabu -s -l 3 -f tests/include/tt01.a" /dev/null >tests/tt01.tmp
+         tr -d '\r' <tests/tt01.tmp | grep "^Yy:" | sed -e 's/^Yy/Xx/'
+         pid=`cat tests/tt01.pid`
+         n=0
+         while kill -0 $pid 2>/dev/null && [ $n -lt 20 ]; do sleep 0.1; n=`expr $n + 1`; done
+         if kill -0 $pid 2>/dev/null; then kill $pid; else echo "Xx:group killed"; fi
+         rm -f tests/tt01.tmp tests/tt01.pid
+      else
+         echo "Xx:SKIPPED script(1) not available"
+      fi
+    }
+
+#STDOUT:Xx:eof
+#STDOUT:Xx:group killed
@@ -85,6 +85,7 @@ static unsigned handle_options(int argc, const char *const *argv)
 	    case 'j': use_server.set(prio, false); break;
 	    case 'J': use_server.set(prio, true); break;
             case 'k': max_warnings.set(prio, 0); break;
+            case 'l': Setting::set("local_jobs", prio, argv[++i]); break;
             case 'K': max_warnings.set(prio, -1); break;
             case 'm': auto_mkdir.set(prio, true); break;
             case 'M': auto_mkdir.set(prio, false); break;
@@ -130,13 +131,38 @@ class ClientCfgReader: public CfgReader
 {
 public:
    ClientCfgReader(const char *fn, int prio) :CfgReader(fn,prio) {}
-   bool host(const char *name, struct sockaddr_in const *sa, int max_jobs, int prio,
-	 const char *cfg) {
-      return job_add_host(name,sa,max_jobs,prio,cfg);
+   bool host(const char *name, struct sockaddr_storage const *sa, int max_jobs, int prio,
+	 const char *cfg, const char *unix_path) {
+      return job_add_host(name,sa,max_jobs,prio,cfg,unix_path);
    }
 };
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liest yabu.cfg und ~/.yaburc. Wir merken uns die Änderungszeit von yabu.cfg für
+// «check_cfg_reload()».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static time_t cfg_mtime = 0;
+
+static void read_cfg_files()
+{
+   if (*yabu_cfg_dir != 0) {
+      Str fn(yabu_cfg_dir);
+      fn.append(CFG_GLOBAL);
+      struct stat sb;
+      cfg_mtime = yabu_stat(fn,&sb) ? sb.st_mtime : 0;
+      ClientCfgReader(fn,Setting::GLOBALRC).read(false);
+   }
+
+   char const *home = getenv("HOME");
+   if (exit_code <= 1 && use_yaburc && home) {
+      Str dir(home);
+      ClientCfgReader(dir.append("/.yaburc"),Setting::RCFILE).read(true);
+   }
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Kommandozeile und ~/.yabrc verarbeiten.
 // argc: Anzahl der Argumente.
@@ -147,6 +173,8 @@ static void parse_args(int argc, char *argv[])
 {
    if ((yabu_cfg_dir = getenv("YABU_CFG_DIR")) == 0)
       yabu_cfg_dir = "";
+   if (const char *jobs = getenv("YABU_JOBS"))	// Vorgabe für -l (z.B. für CI-Systeme)
+      Setting::set("local_jobs", Setting::ENVIRONMENT, jobs);
    int i = handle_options(argc - 1, argv + 1) + 1;
    num_targets = argc - i;
    targets = (const char **) argv + i;
@@ -159,16 +187,51 @@ static void parse_args(int argc, char *argv[])
 	 Message(MSG_E,Msg::no_dir(yabu_cfg_dir));
 	 return;
       }
-      Str dir(yabu_cfg_dir);
-      ClientCfgReader(dir.append(CFG_GLOBAL),Setting::GLOBALRC).read(false);
    }
+   read_cfg_files();
+}
 
-   // ~/.yaburc lesen
-   char const *home = getenv("HOME");
-   if (exit_code <= 1 && use_yaburc && home) {
-      Str dir(home);
-      ClientCfgReader(dir.append("/.yaburc"),Setting::RCFILE).read(true);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liest die Server-Liste während des Builds neu ein, wenn SIGHUP eingetroffen ist oder yabu.cfg
+// sich geändert hat. Neue Server übernehmen sofort Arbeit, entfernte Server führen nur noch ihre
+// laufenden Skripte zu Ende. Die Datei prüfen wir höchstens alle zwei Sekunden. Neue Namen löst
+// ein Kindprozeß auf (siehe «cfg_resolve_async()»), die Verteilung wartet also nicht auf DNS.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static volatile bool got_sighup = false;
+
+void check_cfg_reload()
+{
+   static unsigned long next_check = 0;
+   unsigned long const now = sys_time_ms();
+   if (!got_sighup) {
+      if (*yabu_cfg_dir == 0 || now < next_check)
+	 return;
+      next_check = now + 2000;
+      Str fn(yabu_cfg_dir);
+      fn.append(CFG_GLOBAL);
+      struct stat sb;
+      if (!yabu_stat(fn,&sb) || sb.st_mtime == cfg_mtime)
+	 return;
    }
+   got_sighup = false;
+   job_reload_begin();
+   cfg_cached_addresses(true);		// Kein DNS während des Builds
+   read_cfg_files();
+   cfg_cached_addresses(false);
+   job_reload_end(!cfg_addresses_pending());
+   cfg_resolve_async();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fordert ein Neulesen an, z.B. wenn sich Adressen geändert haben (siehe «cfg_resolve_async()»).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cfg_request_reload()
+{
+   got_sighup = true;
 }
 
 
@@ -190,13 +253,18 @@ static void intr(int sig)
       puts("*** INTR ***");
 }
 
+static void hup(int sig)
+{
+   got_sighup = true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // main() für yabu
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static int yabu_main(int argc, char *argv[])
 {
-   sys_setup_sig_handler(intr,intr,intr);
+   sys_setup_sig_handler(hup,intr,intr);
    set_language();
    if (getcwd(yabu_wd,sizeof(yabu_wd)) == 0)
       YUFTL(G20,syscall_failed("getcwd",0));
@@ -220,6 +288,8 @@ static int yabu_main(int argc, char *argv[])
       }
    }
 
+   job_selection_done();
+
    // Hauptschleife
    while (exit_code < 2 && !job_queue_empty())
       job_process_queue(true);
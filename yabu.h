@@ -91,6 +91,7 @@ public:
    char **env() const;
    const char *operator[] (const char *key) const;
    bool contains(const char *key) const;
+   bool contains_entry(const char *key_val) const;
    unsigned size() const { return n_ - 1; }
 private:
    size_t n_;		// Größe von «buf_» (= Anzahl der Variablen + 1)
@@ -243,6 +244,7 @@ class Setting
 {
 public:
    static const int DEFAULT = 0;        // Prioritätswerte
+   static const int ENVIRONMENT = 2;
    static const int GLOBALRC = 4;
    static const int RCFILE = 5;
    static const int BUILDFILE = 10;
@@ -342,6 +344,8 @@ extern TsAlgo_t global_ts_algo;
 
 extern const char *user_options;
 bool dump_req(char c);
+void check_cfg_reload();
+void cfg_request_reload();
 
 // ===== yastate.cc ===============================================================================
 
@@ -433,6 +437,8 @@ struct Target
    static unsigned total_cancelled;
    static Target *sel_head;		// Für Phase 2 ausgewählte Ziele
    static Target **sel_tail;
+   static unsigned n_sel_build;		// Ausgewählte Ziele mit Regel (für die Fortschrittsanzeige)...
+   static unsigned n_sel_done;		// ... und wie viele davon erledigt sind
 
    Project * const prj_;
    const char *const name_;		// Relativ zum Projektverzeichnis «prj_->root_»
@@ -458,6 +464,7 @@ struct Target
    StringList build_args_;		// Werte für %1, %2, ...
    unsigned rule_id_;			// Signatur der Regel: Wert aus Buildfile.state
    unsigned rule_id_new_;		// Signatur der Regel: Neuer Wert
+   unsigned duration_;			// Laufzeit des letzten Build-Skripts in ms (0: unbekannt)
 
    static const char *status_str(Status st);
    void dump() const;
@@ -470,12 +477,20 @@ struct Target
    bool is_selected() const { return sel_prevp_ != 0; }
    void set_building();
    bool is_leaf();
+   unsigned long critical_path();
+   unsigned fan_out() const;
+   void set_duration(unsigned ms);
+   unsigned long expected_duration() const;
 
    bool is_regular_file_;
    Target *sel_next_;		// Liste der ausgewählten Ziele
    Target **sel_prevp_;
+   bool sel_counted_;		// In «n_sel_build» enthalten
    TargetGroup *group_;		// Gruppe (bei Skripten mit mehreren Ausgabedateien) oder 0
    Target *next_in_group_;	// Verlinkung innerhalb der Gruppe
+   unsigned long crit_path_;	// Siehe «critical_path()»
+   static unsigned long total_duration;	// Summe aller bekannten Laufzeiten...
+   static unsigned n_durations;		// ... und deren Anzahl
 
    Target(Project *prj, const char *name);
    Target(const Target & t);     // Nicht impl.
@@ -512,6 +527,39 @@ private:
 };
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ein Betriebsmittel-Pool (!pool). Ein Build-Skript belegt in jedem Pool, dessen Muster auf das
+// Ziel passen, das zugehörige Gewicht. Die Kapazität gilt getrennt für jede Warteschlange (lokal
+// und pro Server).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Pool;
+
+struct PoolUse {
+   Pool *pool_;			// 0 markiert das Ende einer Liste
+   unsigned weight_;
+};
+
+struct Pool {
+   static Pool *create(const char *name, unsigned capacity);
+   void add(unsigned weight, StringList &tgts);
+   static PoolUse *lookup(const char *tgt);
+   bool fits(unsigned qid, unsigned weight) const;
+   void acquire(unsigned qid, unsigned weight);
+   void release(unsigned qid, unsigned weight);
+   const char * const name_;
+private:
+   Pool(const char *name, unsigned capacity);
+   unsigned capacity_;
+   Pool *next_;
+   StringList tgts_;		// Muster
+   unsigned *weights_;		// Gewicht je Muster
+   unsigned *used_;		// Belegung je Warteschlange
+   size_t n_used_;
+   static Pool *head;
+};
+
+
 struct ConfigureRule {
    ConfigureRule(ConfigureRule ***tail, const char *cfg, StringList &tgts);
    static const char *get_cfg(const ConfigureRule *head, const char *target);
@@ -567,6 +615,7 @@ struct Rule {
 typedef enum { NOTIFY_STARTED, NOTIFY_OK, NOTIFY_FAILED, NOTIFY_CANCELLED } notify_event_t;
 
 void job_export(const char *name, const char *value);
+void job_no_speculate(StringList const &tgts);
 void job_export_var(const char *name);
 void job_export_env(const char *name);
 void job_process_queue(bool wait);
@@ -574,9 +623,15 @@ void job_create(Project *prj, Target *t, char tag, Str const &cmds, unsigned fla
 bool job_queue_empty();
 void job_init();
 void job_shutdown();
-bool job_add_host(const char *name, struct sockaddr_in const *sa,
-      int max_jobs, int prio, const char *cfg);
+void job_progress_clear();
+bool job_add_host(const char *name, struct sockaddr_storage const *sa,
+      int max_jobs, int prio, const char *cfg, const char *unix_path);
+void job_reload_begin();
+void job_reload_end(bool complete);
+void job_selection_done();
 const char *job_local_cfg();
+void job_read_server_stats(const StringList &args);
+void job_write_server_stats(StateFileWriter &sf);
 
 
 
@@ -654,6 +709,8 @@ private:
    void do_rule();
    void do_project(const char *c);
    void do_serialize(const char *c);
+   void do_pool(const char *c);
+   void do_nospeculate(const char *c);
 
 public:
    Project(Project *parent, const char *aroot, const char *rroot,
@@ -782,6 +839,7 @@ namespace Msg
    const char *leaf_exists(const char *target);
    const char *line(const char *fn, const unsigned line);
    const char *line(const SrcLine *src);
+   const char *local_jobs(unsigned n);
    const char *login_failed(const char *host);
    const char *login_result(const char *name, bool ok);
    const char *my_hostname_not_found(const char *cf,const char *hn);
@@ -789,15 +847,19 @@ namespace Msg
    const char *no_queue(Target const *t);
    const char *options();
    const char *process_line(const char *name);
+   const char *progress(unsigned done, unsigned total, unsigned running, unsigned waiting,
+	 const char *eta);
    const char *reading_file(const char *fn, unsigned line, unsigned line2);
    const char *reset_mtime_after_error(const char *target);
    const char *rule_changed(const char *tgt);
    const char *rules();
    const char *rule_unusable(const SrcLine *s, const char *cfg);
+   const char *script_requeued(const char *target, const char *host, unsigned n, unsigned max);
    const char *script_terminated_on_signal(int sig);
    const char *selecting(const char *t);
    const char *server_running(const char *ver, const char *addr);
    const char *server_unavailable(const char *host, int err);
+   const char *servers_reloaded(const char *host, bool added);
    const char *sources();
    const char *srv_usage();
    const char *target_cancelled(const char *name);
@@ -948,6 +1010,7 @@ struct PollObj {
     void set_events(int events);
     int fd() const;
     static bool poll(int timeout);
+    static void watch_children();
     virtual int handle_input(int fd, int events) = 0;
     virtual int handle_output(int fd, int events) { return 1; }
     unsigned const id_;
@@ -957,6 +1020,16 @@ struct PollObj {
 
 // ===== yacomm.cc =================================================================================
 
+// Protokollversionen. Der Client sendet seine Version beim Login ('U'), der Server antwortet mit
+// dem Minimum beider Versionen. Ältere Server antworten ohne Version (= 0).
+static const unsigned PROTO_CANCEL = 1;		// 'K': Skript abbrechen
+static const unsigned PROTO_V2 = 2;		// Variable Längen, binäre Ids, siehe «IoBuffer::next()»
+static const unsigned PROTO_ENV_SNAPSHOT = 3;	// 'S', 'J': Environment-Kopien
+static const unsigned PROTO_BATCH = 4;		// 'B': Alle Blöcke eines Skripts auf einmal
+static const unsigned PROTO_CAPACITY = 5;	// 'L': Server meldet freie Plätze und Last
+static const unsigned PROTO_BUILD_SIZE = 6;	// 'N': Client meldet die Größe des Builds
+static const unsigned PROTO_VERSION = PROTO_BUILD_SIZE;
+
 struct IoBuffer {
    struct Record;
    IoBuffer(PollObj &po);
@@ -965,7 +1038,18 @@ struct IoBuffer {
    bool next();
    void append(char tag, const char *msg, ...);
    void append(char tag, size_t len, char const *data);
+   void append_id(char tag, unsigned id, size_t len = 0, char const *data = 0);
+   void append_output(unsigned id, size_t len, char const *data);
+   void append_status(unsigned id, char how, unsigned code);
+   bool get_id(unsigned *id, char const **data = 0, size_t *len = 0) const;
+   bool get_output(unsigned *id, char const **data, size_t *len) const;
+   bool get_status(unsigned *id, char *how, unsigned *code) const;
    int write(int fd);
+   static bool failed(int rc, int err);
+   size_t pending() const { return wlen_ - wp_; }
+   void clear();
+   void set_version(unsigned version);
+   unsigned version() const { return version_; }
    char tag_;
    size_t len_;
    char *data_;
@@ -980,8 +1064,14 @@ private:
    size_t wmax_;        // Puffergröße
    size_t wp_;          // 1. zu sendendes Zeichen
 
+   unsigned version_;	// Protokollversion, 0 bis zum Login
+   size_t rchunk_;	// Größe des nächsten Lesezugriffs
+   size_t saved_pos_;	// Von «next()» überschriebenes Byte (Position oder 0) ...
+   char saved_char_;	// ... und sein Wert
+
    PollObj &obj_;
-   void commit(char tag, size_t len);
+   char *header(char tag, size_t len);
+   void commit(char *end);
 };
 
 
@@ -991,6 +1081,7 @@ private:
 static const unsigned EXEC_COLLECT_OUTPUT = 1;
 static const unsigned EXEC_MERGE_STDERR = 2;
 static const unsigned EXEC_LOCAL = 4;
+static const unsigned EXEC_NEW_PGRP = 8;
 extern volatile bool got_sigchld;
 typedef void (*yabu_sigh_t)(int sig);
 const char *my_hostname();
@@ -998,12 +1089,24 @@ const char *my_osname();
 const char *my_osrelease();
 const char *my_machine();
 void sys_setup_sig_handler(yabu_sigh_t hup, yabu_sigh_t intr, yabu_sigh_t term);
+int sys_sigchld_fd();
 void set_close_on_exec(int fd);
-bool resolve(struct in_addr *a, const char *name);
+bool sys_read_file(const char *fn, char *buf, size_t size);
+unsigned sys_cpu_count();
+struct SysLoad { double load1, cpu_psi, mem_psi; long mem_avail; };
+void sys_get_load(SysLoad *sl);
+int sys_memfd(const char *name);
+unsigned long sys_time_ms();
+bool resolve(struct sockaddr_storage *sa, const char *name, const char *port);
+bool sys_unix_addr(struct sockaddr_storage *sa, const char *path);
+unsigned sys_addr_len(struct sockaddr_storage const *sa);
+const char *sys_addr2str(struct sockaddr_storage const *sa);
+void sys_tune_socket(int fd, struct sockaddr_storage const *sa);
 int yabu_open(const char *fn, int flags);
 int yabu_read(int fd, void *buf, size_t len);
 int yabu_write(int fd, void const *buf, size_t len);
 bool yabu_fork(int *pipe_fd, pid_t *pid, unsigned flags);
+void sys_kill_group(pid_t pid, int sig);
 bool yabu_stat(const char *name, struct stat *sb);
 void yabu_ftime(Ftime *ft, struct stat const *sb);
 void yabu_cot(const char *fn);
@@ -1011,19 +1114,34 @@ void yabu_cot(const char *fn);
 
 // ===== yacfg.cc ==================================================================================
 
+// Einstellungen für einen Benutzer (Abschnitt !users), nur für yabusrv
+struct UserCfg {
+   unsigned share_;		// Gewicht beim Verteilen der Plätze
+   unsigned max_;		// Max. Anzahl gleichzeitiger Skripte, 0 = unbegrenzt
+   int nice_;			// nice-Wert der Skripte
+   unsigned small_;		// Bis zu so vielen Zielen ist ein Build "klein" ('N'), 0 = nie
+   int small_nice_;		// nice-Wert der Skripte kleiner Builds
+};
+
+void cfg_cached_addresses(bool on);
+bool cfg_addresses_pending();
+void cfg_resolve_async();
+
 class CfgReader: public FileReader {
 public:
    CfgReader(const char *fn, int prio)
       :FileReader(fn,""), prio_(prio), mode_(PREFS)  {}
    virtual ~CfgReader() {}
-   virtual bool host(const char *name, struct sockaddr_in const *sa,
-	 int max_jobs, int prio, const char *cfg) = 0;
+   virtual bool host(const char *name, struct sockaddr_storage const *sa,
+	 int max_jobs, int prio, const char *cfg, const char *unix_path) = 0;
+   virtual bool user(const char *name, UserCfg const &uc) { return true; }
 private:
    int const prio_;
-   enum { IGNORE, PREFS, OPTIONS, SERVERS } mode_;
+   enum { IGNORE, PREFS, OPTIONS, SERVERS, USERS } mode_;
    void process_line(char *c);
    bool do_server(char *lbuf);
    bool do_host(size_t argc, char **argv);
+   bool do_user(char *lbuf);
 };
 
 
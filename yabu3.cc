@@ -39,6 +39,10 @@ void Project::parse_buildfile(SrcLine const *begin, SrcLine const *end)
          do_export(c);
       else if (skip_str(&c, "!serialize "))
          do_serialize(c);
+      else if (skip_str(&c, "!pool "))
+         do_pool(c);
+      else if (skip_str(&c, "!nospeculate "))
+         do_nospeculate(c);
       else if (skip_str(&c, "!project "))
          do_project(c);
       else if (as.split(c)) {
@@ -379,4 +383,64 @@ void Project::do_serialize(const char *c)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Verarbeitet eine !nospeculate-Anweisung: Die Ziele werden nie spekulativ doppelt ausgeführt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Project::do_nospeculate(const char *c)
+{
+   StringList tgts;
+   while (const char *w = next_word(&c))
+      tgts.append(w);
+   job_no_speculate(tgts);
+   ++cur_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Verarbeitet einen !pool-Abschnitt:
+//    !pool <Name> <Kapazität>
+//       [<Gewicht>:] <Ziel>...
+// Fehlt das Gewicht, ist es 1.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Project::do_pool(const char *c)
+{
+   const char *name = next_word(&c);
+   int cap = 0;
+   if (name == 0 || !next_int(&cap,&c) || cap <= 0 || skip_blank(&c) != 0) {
+      YUERR(S01,syntax_error());
+      for (++cur_; cur_ < eoi_ && IS_SPACE(*cur_->text); ++cur_);
+      return;
+   }
+   Pool *p = Pool::create(name,cap);
+
+   // Alle folgenden eingerückten Zeilen enthalten Ziele
+   for (++cur_; cur_ < eoi_ && IS_SPACE(*cur_->text); ++cur_) {
+      YabuContext ctx(cur_,0,0);
+      const char *l = cur_->text;
+      int weight = 1;
+      skip_blank(&l);
+      // Gewicht nur in der Form "N:", sonst sind alle Wörter Ziele (auch "2nd.o")
+      const char *r = l;
+      const char *const end = l + strcspn(l," \t");
+      if (next_int(&weight,&r) && skip_blank(&r) == ':') {
+	 if (weight <= 0) {
+	    YUERR(S01,syntax_error());
+	    continue;
+	 }
+	 l = r + 1;
+      } else if (end > l && end[-1] == ':') {	// Ungültiges Gewicht, z.B. "2x:"
+	 YUERR(S01,syntax_error());
+	 continue;
+      } else
+	 weight = 1;
+      StringList tgts;
+      while (const char *w = next_word(&l))
+	 tgts.append(w);
+      p->add(weight,tgts);
+   }
+}
+
+
 // vim:sw=3 cin fileencoding=utf-8
@@ -29,11 +29,14 @@ void CfgReader::process_line(char *c)
       mode_ = OPTIONS;
    else if (!strcmp(c,"!servers"))
       mode_ = SERVERS;
+   else if (!strcmp(c,"!users"))		// Ältere Versionen überspringen den Abschnitt
+      mode_ = USERS;
    else if (*c == '!')
       mode_ = IGNORE;
    else switch (mode_) {
       case PREFS: Setting::parse_line(c,prio_); break;
       case SERVERS: do_server(c); break;
+      case USERS: do_user(c); break;
       case OPTIONS: var_parse_global_options(c); break;
       case IGNORE: break;
    }
@@ -58,6 +61,192 @@ bool CfgReader::do_server(char *lbuf)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aufgelöste Server-Adressen. Beim Start lösen wir Namen direkt auf. Beim Neulesen während des
+// Builds (siehe «check_cfg_reload()») darf aber nicht die ganze Verteilung auf DNS warten: Dann
+// gelten nur die hier gespeicherten Ergebnisse, und Server mit noch unbekanntem Namen fehlen
+// vorerst. «cfg_resolve_async()» löst anschließend alle Namen in einem Kindprozeß neu auf. Neue
+// oder geänderte Ergebnisse lösen ein weiteres Neulesen aus.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CachedAddr {
+   const char *name_;
+   const char *port_;
+   enum State { PENDING, OK, FAILED } state_;
+   struct sockaddr_storage sa_;
+};
+
+static CachedAddr *addr_cache = 0;
+static size_t n_addr_cache = 0;
+static bool cached_only = false;	// Nicht blockieren, siehe «cfg_cached_addresses()»
+static unsigned n_pending = 0;		// Übersprungene Namen seit «cfg_cached_addresses(true)»
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Schaltet das Auflösen beim Lesen ab (on=true) bzw. wieder ein.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cfg_cached_addresses(bool on)
+{
+   cached_only = on;
+   if (on)
+      n_pending = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Return: true, wenn beim letzten Lesen Server wegen unbekannter Adresse gefehlt haben.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool cfg_addresses_pending()
+{
+   return n_pending > 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wie «resolve()», aber mit Cache.
+// Return: 1: aufgelöst, 0: ungültig, -1: noch unbekannt (nur mit «cached_only»)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int cached_resolve(struct sockaddr_storage *sa, const char *name, const char *port)
+{
+   CachedAddr *ca = addr_cache;
+   CachedAddr *const end = addr_cache + n_addr_cache;
+   while (ca < end && (strcmp(ca->name_,name) || strcmp(ca->port_,port)))
+      ++ca;
+   if (ca == end) {
+      array_realloc(addr_cache,n_addr_cache + 1);
+      ca = addr_cache + n_addr_cache++;
+      ca->name_ = str_freeze(name);
+      ca->port_ = str_freeze(port);
+      ca->state_ = CachedAddr::PENDING;
+      memset(&ca->sa_,0,sizeof(ca->sa_));
+   }
+   if (ca->state_ == CachedAddr::PENDING && !cached_only)
+      ca->state_ = resolve(&ca->sa_,name,port) ? CachedAddr::OK : CachedAddr::FAILED;
+   if (ca->state_ == CachedAddr::PENDING) {
+      ++n_pending;
+      return -1;
+   }
+   *sa = ca->sa_;
+   return ca->state_ == CachedAddr::OK;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kindprozeß, der alle Namen in «addr_cache» auflöst. Er schreibt für jeden Eintrag ein «Result»
+// in die Pipe. Es läuft höchstens ein Kindprozeß. Kommen in der Zwischenzeit neue Namen dazu
+// («again_»), lesen wir danach neu ein, und das Neulesen startet den nächsten Kindprozeß. Fertig
+// ist er, wenn alle «n_» Ergebnisse da sind: Das Dateiende meldet «poll()» nicht immer als
+// POLLIN, sondern schließt den Deskriptor unter Umständen ohne Rückruf (siehe «dispatch()»).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class AddrResolver: public PollObj {
+public:
+   static void start();
+private:
+   struct Result {
+      size_t idx_;
+      int ok_;
+      struct sockaddr_storage sa_;
+   };
+   size_t const n_;
+   Str buf_;
+   AddrResolver(size_t n) :n_(n) {}
+   static AddrResolver *running_;
+   static bool again_;
+   int handle_input(int fd, int events);
+   void finish();
+};
+
+AddrResolver *AddrResolver::running_ = 0;
+bool AddrResolver::again_ = false;
+
+
+void AddrResolver::start()
+{
+   if (running_ != 0 && running_->fd() < 0) {	// Kindprozeß vorzeitig beendet
+      running_->finish();
+      delete running_;
+   }
+   if (running_ != 0) {
+      again_ = true;
+      return;
+   }
+   again_ = false;
+   if (n_addr_cache == 0)
+      return;
+   int fd;
+   pid_t pid;
+   if (!yabu_fork(&fd,&pid,EXEC_COLLECT_OUTPUT))
+      return;
+   if (pid == 0) {
+      for (size_t i = 0; i < n_addr_cache; ++i) {
+	 Result r;
+	 memset(&r,0,sizeof(r));
+	 r.idx_ = i;
+	 r.ok_ = resolve(&r.sa_,addr_cache[i].name_,addr_cache[i].port_);
+	 if (yabu_write(1,&r,sizeof(r)) != (int) sizeof(r))
+	    break;
+      }
+      _exit(0);
+   }
+   running_ = new AddrResolver(n_addr_cache);
+   running_->add_fd(fd);
+}
+
+
+int AddrResolver::handle_input(int fd, int events)
+{
+   buf_.reserve(sizeof(Result) * 16);
+   int const n = yabu_read(fd,buf_.end(),buf_.avail());
+   if (n > 0)
+      buf_.extend(n);
+   if ((n > 0 && buf_.len() < n_ * sizeof(Result)) || (n < 0 && errno == EAGAIN))
+      return 0;
+   finish();
+   delete this;
+   return 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Übernimmt die Ergebnisse des Kindprozesses.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AddrResolver::finish()
+{
+   bool changed = false;
+   for (size_t pos = 0; pos + sizeof(Result) <= buf_.len(); pos += sizeof(Result)) {
+      Result r;
+      memcpy(&r,(const char *) buf_ + pos,sizeof(r));
+      if (r.idx_ >= n_addr_cache)
+	 continue;
+      CachedAddr *const ca = addr_cache + r.idx_;
+      CachedAddr::State const st = r.ok_ ? CachedAddr::OK : CachedAddr::FAILED;
+      if (st != ca->state_ || (st == CachedAddr::OK && memcmp(&r.sa_,&ca->sa_,sizeof(r.sa_)))) {
+	 ca->state_ = st;
+	 ca->sa_ = r.sa_;
+	 changed = true;
+      }
+   }
+   running_ = 0;
+   if (changed || again_)
+      cfg_request_reload();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Löst alle Server-Namen im Hintergrund neu auf, siehe «CachedAddr».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cfg_resolve_async()
+{
+   AddrResolver::start();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Eine "host"-Zeile verarbeiten.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -66,32 +255,43 @@ bool CfgReader::do_host(size_t argc, char **argv)
 {
    if (argc < 2) return false;
 
-   // 1. Argument: host[:[addr[:port]]]
+   // 1. Argument: host[:[addr[:port]]], IPv6-Adressen in eckigen Klammern
    char *name = argv[1];
    char *c = 0;
-   struct sockaddr_in sa;
-   memset(&sa,0,sizeof(sa));
+   struct sockaddr_storage sa;
+   bool has_addr = false;
    if ((c = strchr(name,':')) != 0) {
       *c++ = 0;
-      sa.sin_family = AF_INET;
-      char * const addr = *c ? c : name;	// Default ist «addr» = «name»
+      char * addr = *c ? c : name;		// Default ist «addr» = «name»
       const char * port = DEFAULT_PORT;
-      if ((c = strchr(addr,':')) != 0) {
+      if (*addr == '[' && (c = strchr(addr,']')) != 0) {
+	 *c++ = 0;
+	 ++addr;
+	 if (*c == ':')
+	    port = c + 1;
+	 else if (*c != 0)
+	    port = "";
+      }
+      else if ((c = strchr(addr,':')) != 0) {
 	 *c++ = 0;
 	 port = c;
       }
       int p = -1;
-      if (!str2int(&p,port) || p < 1 || p > 65534 || !resolve(&sa.sin_addr,addr)) {
+      int const rc = (str2int(&p,port) && p >= 1 && p <= 65534) ? cached_resolve(&sa,addr,port) : 0;
+      if (rc < 0)
+	 return true;				// Kommt nach «cfg_resolve_async()» dazu
+      if (rc == 0) {
 	 Message(MSG_W,"Ungültige Adresse '%s:%s'",addr,port);
 	 return false;
       }
-      sa.sin_port = ntohs(p);
+      has_addr = true;
    }
 
    // Weitere optionale Argumente
    char const *cfg = "";
    int max = 1;
    int prio = 1;
+   char const *unix_path = 0;
    for (size_t i = 2; i < argc; ++i) {
       bool ok = true;
       if (!strncmp(argv[i],"cfg=",4)) {
@@ -102,14 +302,61 @@ bool CfgReader::do_host(size_t argc, char **argv)
 	 ok = str2int(&max,argv[i] + 4);
       else if (!strncmp(argv[i],"prio=",5))
 	 ok = str2int(&prio,argv[i] + 5);
+      else if (!strncmp(argv[i],"unix=",5)) {
+	 unix_path = argv[i] + 5;
+	 ok = *unix_path == '/';
+      }
       else
 	 ok = false;
       if (!ok) return false;
    }
    if (max < 1) max = 1;
-   return host(name,sa.sin_family ? &sa : 0,max,prio,cfg);
+   return host(name,has_addr ? &sa : 0,max,prio,cfg,unix_path);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Eine Zeile im Abschnitt !users verarbeiten:
+//    name|* [share=N] [max=N] [nice=N] [small=N] [smallnice=N]
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CfgReader::do_user(char *lbuf)
+{
+   size_t argc;
+   char *argv[20];
+   static const size_t MAX_ARGC = sizeof(argv) / sizeof(argv[0]);
+   char *c = lbuf;
+   for (argc = 0; argc < MAX_ARGC && (argv[argc] = str_chop(&c)) != 0; ++argc);
+   if (argc < 1) return false;
+   int share = 1, max = 0, nice = 5, small = 0, small_nice = 0;
+   bool has_small_nice = false;
+   for (size_t i = 1; i < argc; ++i) {
+      bool ok = true;
+      if (!strncmp(argv[i],"share=",6))
+	 ok = str2int(&share,argv[i] + 6) && share > 0;
+      else if (!strncmp(argv[i],"max=",4))
+	 ok = str2int(&max,argv[i] + 4) && max >= 0;
+      else if (!strncmp(argv[i],"nice=",5))
+	 ok = str2int(&nice,argv[i] + 5);
+      else if (!strncmp(argv[i],"small=",6))
+	 ok = str2int(&small,argv[i] + 6) && small >= 0;
+      else if (!strncmp(argv[i],"smallnice=",10))
+	 ok = has_small_nice = str2int(&small_nice,argv[i] + 10);
+      else
+	 ok = false;
+      if (!ok) {
+	 YUERR(S01,syntax_error(argv[i]));
+	 return false;
+      }
+   }
+   UserCfg uc;
+   uc.share_ = share;
+   uc.max_ = max;
+   uc.nice_ = nice;
+   uc.small_ = small;
+   uc.small_nice_ = has_small_nice ? small_nice : nice;
+   return user(argv[0],uc);
+}
+
 
 // vim:shiftwidth=3:cindent
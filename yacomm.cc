@@ -9,7 +9,23 @@
 #include "yabu.h"
 
 #include <unistd.h>
+#include <errno.h>
 #include <poll.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0		// Dann muß SIGPIPE anderweitig abgefangen werden
+#endif
+
+// Größe der Lesezugriffe. Sie wächst bis MAX_READ_CHUNK, solange ein Aufruf den Puffer füllt.
+static const size_t MIN_READ_CHUNK = 4096;
+static const size_t MAX_READ_CHUNK = 256 * 1024;
+
+// Maximale Länge eines Headers (Kennung und Länge) in beiden Protokollversionen
+static const size_t MAX_HEADER = 1 + 5;
+
+// Größter Ausgabeblock, der in einen Datensatz des alten Protokolls paßt
+static const size_t MAX_V1_OUTPUT = 0xFFFFFF - 8;
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -32,6 +48,53 @@ static void put3(void *c, size_t val)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Zahlen in Protokoll 2 hardwareunabhängig kodieren/dekodieren: Ids und Statuswerte mit festen 4
+// Bytes (big endian), Längen mit 7 Bit je Byte, niederwertige Bits zuerst. Das höchste Bit ist
+// gesetzt, wenn ein weiteres Byte folgt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned get4(void const *c)
+{
+    unsigned char const *p = (unsigned char const *)c;
+    return ((unsigned) p[0] << 24) | ((unsigned) p[1] << 16) | ((unsigned) p[2] << 8) | p[3];
+}
+
+static void put4(void *c, unsigned val)
+{
+   unsigned char *p = (unsigned char *)c;
+   p[0] = val >> 24;
+   p[1] = val >> 16;
+   p[2] = val >> 8;
+   p[3] = val;
+}
+
+// Return: Anzahl Bytes oder 0, falls die Länge noch nicht vollständig im Puffer steht
+static size_t get_varint(void const *c, size_t avail, size_t *val)
+{
+   unsigned char const *p = (unsigned char const *)c;
+   *val = 0;
+   for (size_t i = 0; i < avail && i < MAX_HEADER - 1; ++i) {
+      *val |= (size_t) (p[i] & 0x7F) << (7 * i);
+      if ((p[i] & 0x80) == 0 || i == MAX_HEADER - 2)
+	 return i + 1;
+   }
+   return 0;
+}
+
+static size_t put_varint(void *c, size_t val)
+{
+   unsigned char *p = (unsigned char *)c;
+   size_t n = 0;
+   while (val >= 0x80) {
+      p[n++] = (val & 0x7F) | 0x80;
+      val >>= 7;
+   }
+   p[n++] = val;
+   return n;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Konstruktor
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,6 +102,7 @@ static void put3(void *c, size_t val)
 IoBuffer::IoBuffer(PollObj &obj)
     :rbuf_(0), rlen_(0), rmax_(0), rp_(0),
      wbuf_(0), wlen_(0), wmax_(0), wp_(0),
+     version_(0), rchunk_(MIN_READ_CHUNK), saved_pos_(0), saved_char_(0),
      obj_(obj)
 {
 }
@@ -55,6 +119,31 @@ IoBuffer::~IoBuffer()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Empfangs- und Sendepuffer leeren (z.B. nach Verbindungsabbruch). Eine neue Verbindung beginnt
+// wieder mit dem alten Protokoll.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IoBuffer::clear()
+{
+   rlen_ = rp_ = 0;
+   wlen_ = wp_ = 0;
+   version_ = 0;
+   saved_pos_ = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Protokollversion nach dem Login umschalten. Betrifft alle folgenden Datensätze in beiden
+// Richtungen; vorher darf die Gegenseite nichts weiter senden.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IoBuffer::set_version(unsigned version)
+{
+   version_ = version;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Puffer auf mindestens «req» Bytes vergrößern
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,15 +157,23 @@ static void reserve(char *&buf, size_t &buf_size, size_t req)
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Daten empfangen und an den Puffer anhängen. Returnwert wie bei «read()».
+// Daten empfangen und an den Puffer anhängen. Returnwert wie bei «read()». Ein Byte bleibt immer
+// frei, siehe «next()». Füllt ein Aufruf den Puffer, lesen wir beim nächsten Mal doppelt so viel.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int IoBuffer::read(int fd)
 {
-   reserve(rbuf_,rmax_,rlen_ + 200);
-   int rc =::read(fd, rbuf_ + rlen_, rmax_ - rlen_);
-   if (rc > 0)
+   reserve(rbuf_,rmax_,rlen_ + rchunk_ + 1);
+   size_t const avail = rmax_ - rlen_ - 1;
+   int rc;
+   do
+      rc =::read(fd, rbuf_ + rlen_, avail);
+   while (rc < 0 && errno == EINTR);
+   if (rc > 0) {
       rlen_ += rc;
+      if ((size_t) rc == avail && rchunk_ < MAX_READ_CHUNK)
+	 rchunk_ *= 2;
+   }
    return rc;
 }
 
@@ -84,13 +181,31 @@ int IoBuffer::read(int fd)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Nächsten Datensatz abrufen. Return ist «false», falls kein vollständiger Datensatz im Puffer
 // steht.
+// In Protokoll 2 folgt auf die Daten kein NUL. Wir überschreiben deshalb vorübergehend das erste
+// Byte des nächsten Datensatzes und stellen es beim nächsten Aufruf wieder her.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 bool IoBuffer::next()
 {
-    if (rp_ + 4 > rlen_) return false;		// Header vollständig?
-    len_ = get3(rbuf_ + rp_ + 1);
-    if (rp_ + 4 + len_ + 1 > rlen_) {		// Daten vollständig?
+    if (saved_pos_ > 0) {
+       rbuf_[saved_pos_] = saved_char_;
+       saved_pos_ = 0;
+    }
+
+    size_t hlen = 0;				// Länge des Headers, 0 = unvollständig
+    size_t tail = 0;				// NUL im alten Protokoll
+    if (version_ < PROTO_V2) {
+       if (rp_ + 4 <= rlen_) {
+	  hlen = 4;
+	  len_ = get3(rbuf_ + rp_ + 1);
+	  tail = 1;
+       }
+    } else if (rp_ + 1 < rlen_) {
+       size_t const n = get_varint(rbuf_ + rp_ + 1,rlen_ - rp_ - 1,&len_);
+       if (n > 0)
+	  hlen = 1 + n;
+    }
+    if (hlen == 0 || rp_ + hlen + len_ + tail > rlen_) {	// Daten vollständig?
 	if (rp_ > 0) {				// Fragment an den Pufferanfang verschieben
 	    rlen_ -= rp_;
 	    memmove(rbuf_,rbuf_ + rp_,rlen_);
@@ -101,24 +216,51 @@ bool IoBuffer::next()
 
     // Datensatz ist vollständig
     tag_ = rbuf_[rp_];
-    data_ = rbuf_ + rp_ + 4;
-    if ((rp_ += 4 + len_ + 1) >= rlen_)		// Puffer ist leer geworden
+    data_ = rbuf_ + rp_ + hlen;
+    size_t const end = rp_ + hlen + len_;
+    if (tail == 0) {
+       if (end < rlen_) {
+	  saved_pos_ = end;
+	  saved_char_ = rbuf_[end];
+       }
+       rbuf_[end] = 0;				// Siehe «read()»: Platz ist immer vorhanden
+    }
+    if ((rp_ = end + tail) >= rlen_)		// Puffer ist leer geworden
        rp_ = rlen_ = 0;
     return true;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Datensatz zum Senden freigeben. Inhalt muß bereits besetzt sein, Header und NUL werden hier
-// eingetragen.
+// Header eines Datensatzes an das Ende des Sendepuffers schreiben. Der Platz muß bereits reserviert
+// sein (höchstens MAX_HEADER Bytes). Return: Anfang der Daten.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *IoBuffer::header(char tag, size_t len)
+{
+   char *p = wbuf_ + wlen_;
+   *p++ = tag;
+   if (version_ < PROTO_V2) {
+      put3(p,len);
+      p += 3;
+   } else
+      p += put_varint(p,len);
+   return p;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Datensatz zum Senden freigeben. Inhalt muß bereits besetzt sein, «end» zeigt auf das Ende der
+// Daten. Im alten Protokoll folgt noch ein NUL.
+// Alle wartenden Datensätze stehen hintereinander im Sendepuffer und gehen mit einem einzigen
+// «write()» hinaus, siehe «write()».
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void IoBuffer::commit(char tag, size_t len)
+void IoBuffer::commit(char *end)
 {
-   wbuf_[wlen_] = tag;
-   put3(wbuf_ + wlen_ + 1,len);
-   wbuf_[wlen_ + 4 + len] = 0;
-   wlen_ += len + 5;
+   if (version_ < PROTO_V2)
+      *end++ = 0;
+   wlen_ = end - wbuf_;
    YABU_ASSERT(wlen_ <= wmax_);
    obj_.set_events(POLLOUT);
 }
@@ -126,20 +268,30 @@ void IoBuffer::commit(char tag, size_t len)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Stellt einen Datensatz in die Warteschlange. Der Inhalt wird mit printf()-Syntax formatiert.
+// Die Länge steht erst nach dem Formatieren fest; wir formatieren deshalb hinter den längsten
+// möglichen Header und verschieben die Daten bei Bedarf.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void IoBuffer::append(char tag, const char *msg, ...)
 {
-   reserve(wbuf_,wmax_,wlen_ + 200);
-   va_list al;
+   reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + 200);
+   va_list al, al2;
    va_start(al,msg);
-   int len = vsnprintf(wbuf_ + wlen_ + 4,wmax_ - wlen_ - 4,msg,al);
-   if (len < 0) return;
-   if ((size_t) len >= wmax_ - wlen_ - 4) {
-      reserve(wbuf_,wmax_,wlen_ + len + 5);
-      vsnprintf(wbuf_ + wlen_ + 4,wmax_ - wlen_ - 4,msg,al);	// 2. Versuch
+   va_copy(al2,al);
+   char *const tmp = wbuf_ + wlen_ + MAX_HEADER;
+   int len = vsnprintf(tmp,wmax_ - wlen_ - MAX_HEADER,msg,al);
+   va_end(al);
+   if (len >= 0 && (size_t) len >= wmax_ - wlen_ - MAX_HEADER) {
+      reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + len + 1);
+      vsnprintf(wbuf_ + wlen_ + MAX_HEADER,wmax_ - wlen_ - MAX_HEADER,msg,al2);	// 2. Versuch
    }
-   commit(tag,len);
+   va_end(al2);
+   if (len < 0) return;
+   char *const data = wbuf_ + wlen_ + MAX_HEADER;
+   char *const p = header(tag,len);
+   if (p != data)
+      memmove(p,data,len);
+   commit(p + len);
 }
 
 
@@ -149,14 +301,122 @@ void IoBuffer::append(char tag, const char *msg, ...)
 
 void IoBuffer::append(char tag, size_t len, char const *data)
 {
-   reserve(wbuf_,wmax_,wlen_ + len + 4);
-   memcpy(wbuf_ + wlen_ + 4,data,len);
-   commit(tag,len);
+   reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + len + 1);
+   char *const p = header(tag,len);
+   memcpy(p,data,len);
+   commit(p + len);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Datensätze mit Id ('I', 'J', 'K', 'O', 'S', 'T'). Im alten Protokoll steht die Id hexadezimal als
+// Text am Anfang, in Protokoll 2 binär mit 4 Bytes, ebenso der Exit-Status in 'T'. Weitere Daten
+// («len», «data») gibt es nur in Protokoll 2.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IoBuffer::append_id(char tag, unsigned id, size_t len, char const *data)
+{
+   if (version_ < PROTO_V2) {
+      YABU_ASSERT(len == 0);
+      append(tag,"%x",id);
+      return;
+   }
+   reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + 4 + len);
+   char *const p = header(tag,4 + len);
+   put4(p,id);
+   if (len > 0)
+      memcpy(p + 4,data,len);
+   commit(p + 4 + len);
+}
+
+
+// Ausgabe eines Skripts. Im alten Protokoll ist ein Datensatz auf 16 MB begrenzt, größere Blöcke
+// teilen wir auf.
+void IoBuffer::append_output(unsigned id, size_t len, char const *data)
+{
+   if (version_ < PROTO_V2) {
+      do {
+	 size_t const n = len < MAX_V1_OUTPUT ? len : MAX_V1_OUTPUT;
+	 reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + 8 + n + 1);
+	 char *const p = header('O',8 + n);
+	 snprintf(p,9,"%08x",id);
+	 memcpy(p + 8,data,n);
+	 commit(p + 8 + n);
+	 data += n;
+	 len -= n;
+      } while (len > 0);
+      return;
+   }
+   append_id('O',id,len,data);
+}
+
+
+// Ende eines Skripts: «how» ist 'E' (exit), 'S' (Signal) oder '?'.
+void IoBuffer::append_status(unsigned id, char how, unsigned code)
+{
+   if (version_ < PROTO_V2) {
+      append('T',"%x %c %x",id,how,code);
+      return;
+   }
+   reserve(wbuf_,wmax_,wlen_ + MAX_HEADER + 9);
+   char *const p = header('T',9);
+   put4(p,id);
+   p[4] = how;
+   put4(p + 5,code);
+   commit(p + 9);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Daten schreiben. Return wie «::write()»
+// Felder des aktuellen Datensatzes (siehe «next()») dekodieren, Gegenstück zu «append_id()» usw.
+// Return: false bei ungültigem Datensatz
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Ohne «data» muß der Datensatz genau die Id enthalten
+bool IoBuffer::get_id(unsigned *id, char const **data, size_t *len) const
+{
+   if (version_ < PROTO_V2)
+      return data == 0 && sscanf(data_,"%x",id) == 1;
+   if (len_ < 4 || (data == 0 && len_ != 4)) return false;
+   *id = get4(data_);
+   if (data) {
+      *data = data_ + 4;
+      *len = len_ - 4;
+   }
+   return true;
+}
+
+
+bool IoBuffer::get_output(unsigned *id, char const **data, size_t *len) const
+{
+   size_t const hlen = version_ < PROTO_V2 ? 8 : 4;
+   if (len_ <= hlen) return false;
+   if (version_ < PROTO_V2) {
+      if (sscanf(data_,"%8x",id) != 1) return false;
+   } else
+      *id = get4(data_);
+   *data = data_ + hlen;
+   *len = len_ - hlen;
+   return true;
+}
+
+
+bool IoBuffer::get_status(unsigned *id, char *how, unsigned *code) const
+{
+   if (version_ < PROTO_V2)
+      return sscanf(data_,"%x %c %x",id,how,code) == 3;
+   if (len_ != 9) return false;
+   *id = get4(data_);
+   *how = data_[4];
+   *code = get4(data_ + 5);
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Daten schreiben. Return wie «::write()». Alle bis dahin angesammelten Datensätze gehen in einem
+// Aufruf hinaus. Der Socket ist nicht-blockierend; was nicht sofort hinausgeht, bleibt im Puffer,
+// bis «poll()» wieder POLLOUT meldet.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int IoBuffer::write(int fd)
@@ -164,9 +424,16 @@ int IoBuffer::write(int fd)
    int rc = 0;
 
    if (wp_ < wlen_) {
-      rc = ::write(fd,wbuf_ + wp_,wlen_ - wp_);
+      do
+	 rc = ::send(fd,wbuf_ + wp_,wlen_ - wp_,MSG_NOSIGNAL);
+      while (rc < 0 && errno == EINTR);
       if (rc > 0 && (wp_ += rc) == wlen_)
 	 wp_ = wlen_ = 0;
+      else if (wp_ > wlen_ / 2) {	// Gesendeten Teil entfernen, damit der Puffer nicht wächst
+	 wlen_ -= wp_;
+	 memmove(wbuf_,wbuf_ + wp_,wlen_);
+	 wp_ = 0;
+      }
    }
 
    if (wp_ >= wlen_)
@@ -175,4 +442,15 @@ int IoBuffer::write(int fd)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prüft das Ergebnis von «read()» oder «write()» auf einen Fehler, der die Verbindung beendet.
+// EAGAIN ist kein Fehler, der Aufruf wird später wiederholt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool IoBuffer::failed(int rc, int err)
+{
+   return rc < 0 && err != EAGAIN && err != EWOULDBLOCK && err != EINTR;
+}
+
+
 // vim:shiftwidth=3:cindent
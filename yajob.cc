@@ -25,52 +25,221 @@
 #include <unistd.h>
 
 static IntegerSetting max_output_lines("max_output_lines",-1,INT_MAX,0);
-static const unsigned MAX_SERVERS = 64;		// Bis zu 63 Server
+static IntegerSetting max_retries("max_retries",0,100,2);	// Neustarts nach Serverausfall
+static IntegerSetting max_reconnects("max_reconnects",0,100,3);	// Siehe «Server::shutdown()»
+static IntegerSetting speculate("speculate",0,100000,0);	// Siehe «Script::speculate()»
+static StringList no_speculate;					// Ziele laut !nospeculate
+static BooleanSetting show_progress("progress",true);	// Fortschrittsanzeige auf einem Terminal
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Anzahl gleichzeitiger lokaler Jobs (-l, YABU_JOBS). Der Wert "auto" steht für die Anzahl der
+// verfügbaren CPUs, 0 bedeutet: Vorgabe aus yabu.cfg («max=» in der host-Zeile) verwenden.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class JobsSetting: public Setting {
+public:
+   JobsSetting(const char *name) :Setting(name), value_(0) {}
+   operator unsigned() const { return value_; }
+private:
+   unsigned value_;
+   void set_impl(const char *value);
+   Str printable_value() const { return Str().printf("%u",value_); }
+};
+
+void JobsSetting::set_impl(const char *value)
+{
+   int n;
+   skip_blank(&value);
+   if (!strcmp(value,"auto"))
+      value_ = sys_cpu_count();
+   else if (!str2int(&n,value))
+      YUERR(S08,bad_int_value(value));
+   else if (n < 0 || n > 9999)
+      YUERR(S09,int_out_of_range(n,0,9999));
+   else
+      value_ = n;
+}
+
+static JobsSetting local_jobs("local_jobs");
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dürfen freie lokale Plätze Skripte übernehmen, die auch auf einem Server laufen könnten?
+// "no": nein; "any": ja, in der normalen Reihenfolge; "short": ja, die kürzesten Skripte zuerst
+// (gemäß den gespeicherten Laufzeiten).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class StealSetting: public Setting {
+public:
+   enum Mode { NO, ANY, SHORT };
+   StealSetting(const char *name, Mode dflt) :Setting(name), value_(dflt) {}
+   operator Mode() const { return value_; }
+private:
+   Mode value_;
+   void set_impl(const char *value);
+   Str printable_value() const { return Str(value_ == NO ? "no" : value_ == ANY ? "any" : "short"); }
+};
+
+void StealSetting::set_impl(const char *value)
+{
+   skip_blank(&value);
+   if (!strcmp(value,"no"))
+      value_ = NO;
+   else if (!strcmp(value,"any") || !strcmp(value,"yes"))
+      value_ = ANY;
+   else if (!strcmp(value,"short"))
+      value_ = SHORT;
+   else
+      YUERR(S01,syntax_error(value));
+}
+
+static StealSetting local_steal("local_steal",StealSetting::ANY);
+static BooleanSetting use_jobserver("jobserver",true);	// Jobserver von make benutzen
+static BooleanSetting own_jobserver("jobserver_create",false);	// Eigenen Jobserver anbieten
+
+// Grenzwerte für die Anpassung der lokalen Parallelität an die Systemlast (0 = keine Grenze)
+static IntegerSetting max_load("max_load",0,INT_MAX,0);			// Load average
+static IntegerSetting max_cpu_pressure("max_cpu_pressure",0,100,0);	// PSI cpu, %
+static IntegerSetting max_mem_pressure("max_mem_pressure",0,100,0);	// PSI memory, %
+static IntegerSetting min_mem_available("min_mem_available",0,INT_MAX,0);	// MB
+
 static const char TMP_FILE_PREFIX[] = "/tmp/y%";
-static unsigned char const EMPTY_MASK[MAX_SERVERS / 8] = {0};	// Nicht ausführbar
-static unsigned char const LOCAL_MASK[MAX_SERVERS / 8] = {1,0};	// Nur lokal ausführbar
 static char EMPTY[1] = {0};
 static StringList exports;			// Zu exportierende Variablen
 static bool idle = false;			// (Neue) Jobs sind ausführbar
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Eine Menge von Warteschlangen: Bit «qid» ist gesetzt, wenn die Warteschlange «qid» benutzbar ist.
+// Bit 0 steht für die lokale Warteschlange. Die Größe richtet sich nach der Anzahl der Server und
+// kann wachsen, wenn «job_reload_end()» Server hinzufügt. Fehlende Bytes gelten als 0.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct QueueMask {
+   QueueMask() :bits_(0), size_(0) {}
+   QueueMask(QueueMask const &m) :bits_(0), size_(0) { *this = m; }
+   ~QueueMask() { free(bits_); }
+   QueueMask &operator=(QueueMask const &m);
+   bool operator==(QueueMask const &m) const;
+   bool test(unsigned qid) const
+      { return qid / 8 < size_ && (bits_[qid / 8] & (1 << (qid % 8))) != 0; }
+   void set(unsigned qid);
+   void clear(unsigned qid) { if (qid / 8 < size_) bits_[qid / 8] &= ~(1 << (qid % 8)); }
+   void clear_all() { if (size_ > 0) memset(bits_,0,size_); }
+   bool empty() const { return first_set(0) < 0; }
+   bool local_only() const { return test(0) && first_set(1) < 0; }
+private:
+   unsigned char *bits_;
+   size_t size_;		// Anzahl Bytes in «bits_»
+   int first_set(unsigned from) const;
+};
+
+QueueMask &QueueMask::operator=(QueueMask const &m)
+{
+   if (this != &m) {
+      if (size_ < m.size_) {
+	 array_realloc(bits_,m.size_);
+	 size_ = m.size_;
+      }
+      clear_all();
+      if (m.size_ > 0)
+	 memcpy(bits_,m.bits_,m.size_);
+   }
+   return *this;
+}
+
+bool QueueMask::operator==(QueueMask const &m) const
+{
+   size_t const n = size_ > m.size_ ? size_ : m.size_;
+   for (size_t i = 0; i < n; ++i) {
+      if ((i < size_ ? bits_[i] : 0) != (i < m.size_ ? m.bits_[i] : 0))
+	 return false;
+   }
+   return true;
+}
+
+void QueueMask::set(unsigned qid)
+{
+   if (qid / 8 >= size_) {
+      array_realloc(bits_,qid / 8 + 1);
+      while (size_ <= qid / 8)
+	 bits_[size_++] = 0;
+   }
+   bits_[qid / 8] |= 1 << (qid % 8);
+}
+
+// Erstes gesetztes Bit ab «from» oder -1
+int QueueMask::first_set(unsigned from) const
+{
+   for (unsigned q = from; q / 8 < size_; ++q) {
+      if (bits_[q / 8] == 0)
+	 q |= 7;		// Ganzes Byte überspringen
+      else if (test(q))
+	 return q;
+   }
+   return -1;
+}
+
+
 // Ein ausführbares Skript
 
+struct ReadyList;
+struct EnvSnapshot;
+
 struct Script {
    unsigned const id_;
    Target * const tgt_;				// Zugehöriges Ziel oder 0.
    bool const no_exec_;				// Ausführung simulieren
-   unsigned char qmask_[MAX_SERVERS / 8];	// Verfügbare Server für dieses Skript
+   QueueMask qmask_;				// Verfügbare Server für dieses Skript
    Str cmds_;					// Kommandos
    unsigned const flags_;
    Str obuf_;					// Ausgaben
    Project * prj_;
+   PoolUse *pools_;				// Belegte Pools (!pool) oder 0
+   unsigned long prio_;				// Priorität: Länge des kritischen Pfades
+   unsigned fan_out_;				// Zweite Priorität: Anzahl abhängiger Ziele
 
    Script(Project *prj, Target *t, char tag, Str const &cmds, unsigned flags);
    ~Script();
    bool init();
    void setup_env();
-   static Script *find(unsigned queue);
+   static Script *find(unsigned queue, bool activate = true, unsigned long max_ms = 0);
    bool next_step(bool prev_ok);
    char *chunk() const { return chunk_ ? chunk_ : EMPTY; }
    static bool empty();
    static void clear_queue_mask(unsigned qid);
+   static void reselect_all();
    char **env() const { return env_.env(); }
+   EnvSnapshot *snapshot() const { return snap_; }
+   void remaining_chunks(Str &buf) const;
+   bool discarded() const { return discard_; }
+   bool speculative() const { return spec_; }
    static void cancel_waiting();
    void set_local_env();
-   void requeue();
+   bool requeue(unsigned qid, bool keep);
+   static void speculate();
    void cancel();
    static unsigned count_active();
+   static void progress();
 
 private:
    char const tag_;
-   static Script *whead;		// Wartende Skripte ("W-Liste")
-   static Script **wtail;
+   static ReadyList *rl_head;		// Wartende Skripte ("W-Listen"), eine Liste je Maske
+   static unsigned n_waiting;		// Anzahl wartender Skripte
    static Script *ahead;		// Skripte in Bearbeitung ("A-Liste")
    static Script **atail;
    static unsigned count;		// Anzahl aller Skripte
-   StringMap env_;			// Zusätzlich zu «static_env»
+   EnvSnapshot *snap_;			// Stand von «static_env» bei der Erzeugung
+   StringMap env_;			// «snap_» und Variablen aus «setup_env()»
    const char *host_;			// Ausführender Server
+   unsigned long start_ms_;		// Startzeit, siehe «sys_time_ms()»
+   int qid_;				// Ausführende Warteschlange oder -1
+   unsigned retries_;			// Anzahl Neustarts, siehe «requeue()»
+   Script *twin_;			// Andere Kopie bei spekulativer Ausführung oder 0
+   bool spec_;				// Spekulative Kopie
+   bool discard_;			// Ergebnis verwerfen, keine Benachrichtigungen mehr
+   ReadyList *rl_;			// W-Liste, in der das Skript wartet, oder 0
    Script *next_;
    Script **prevp_;
    char *chunk_;			// Aktueller Block - siehe «next_chunk()»
@@ -78,14 +247,52 @@ private:
    char saved_char_;			// Gesichertes Zeichen - siehe «next_chunk()»
 
    void notify(notify_event_t event);
+   bool fits(unsigned qid) const;
+   bool is_short(unsigned long max_ms) const
+      { return max_ms == 0 || tgt_ == 0 || tgt_->expected_duration() <= max_ms; }
+   bool precedes(Script const *s) const;
+   void enqueue();
    bool is_in_list(Script *head);
    bool next_chunk();
    void activate(unsigned qid);
    void unlink();
+   void discard();
 };
 
-Script *Script::whead = 0;
-Script **Script::wtail = &whead;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Eine W-Liste: alle wartenden Skripte mit derselben Maske, sortiert nach Priorität. Es gibt nur
+// wenige verschiedene Masken (eine je Konfiguration), so daß «Script::find()» nur die Listenköpfe
+// vergleichen muß und nicht alle wartenden Skripte.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ReadyList {
+   QueueMask mask_;
+   Script *head_;
+   Script **tail_;
+   Script *last_;		// Letztes Skript oder 0 (unbekannt), siehe «Script::enqueue()»
+   ReadyList *next_;
+   static ReadyList *get(ReadyList **head, QueueMask const &mask);
+};
+
+ReadyList *ReadyList::get(ReadyList **head, QueueMask const &mask)
+{
+   ReadyList *rl;
+   for (rl = *head; rl && !(rl->mask_ == mask); rl = rl->next_);
+   if (rl == 0) {
+      rl = new ReadyList;
+      rl->mask_ = mask;
+      rl->head_ = 0;
+      rl->tail_ = &rl->head_;
+      rl->last_ = 0;
+      rl->next_ = *head;
+      *head = rl;
+   }
+   return rl;
+}
+
+ReadyList *Script::rl_head = 0;
+unsigned Script::n_waiting = 0;
 Script *Script::ahead = 0;
 Script **Script::atail = &ahead;
 unsigned Script::count = 0;
@@ -103,15 +310,19 @@ struct Job: public PollObj {
    bool do_next_chunk(bool prev_okay);
    static void start_jobs();
    static void cancel_all();
+   static void terminate_all();
+   static void kill_script(Script const *s);
 private:
    Script * const script_;
    Job *next_;
    Job **prevp_;
    pid_t pid_;
+   bool token_;			// Job belegt ein Token des Jobservers
    Str file_name_;
    void cleanup();
    void exec(const char *dir, char *chunk);
-   void exec_shell(const char *shell, const char *dir, const char *arg1, const char *arg2);
+   void exec_shell(const char *shell, const char *dir, const char *arg1, const char *arg2,
+	 int script_fd = -1);
    int handle_input(int fd, int events);
    static Job *find_pid(pid_t pid);
    static unsigned count;
@@ -120,14 +331,52 @@ private:
 };
 
 unsigned Job::count = 0;		// Anzahl aktiver (lokaler) Jobs 
-static unsigned max_active = 1;		// Maximale Anzahl aktiver Jobs
+static unsigned max_active = 1;		// Maximale Anzahl aktiver Jobs laut yabu.cfg
 Job *Job::head = 0;			// Liste aller Jobs
 Job **Job::tail = &head;
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Jobserver-Protokoll von GNU make. Jeder lokale Job außer dem ersten benötigt ein Token (ein Byte)
+// aus einer Pipe bzw. FIFO, die sich alle Programme eines Builds teilen. Läuft yabu unter
+// «make -jN», benutzen wir den Jobserver aus MAKEFLAGS. Andernfalls erzeugen wir auf Wunsch
+// («jobserver_create») bei parallelem Build selbst einen und übergeben ihn über MAKEFLAGS an lokale
+// Skripte, so daß make oder ninja in Unter-Builds dasselbe Budget verwenden. Die Anzahl der Tokens
+// folgt dann «local_limit()», siehe «resize()».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TokenQueue: public PollObj
+{
+public:
+   static TokenQueue *get();
+   bool get_token();
+   void return_token();
+   void resize(unsigned limit);
+   const char *makeflags() const { return makeflags_; }
+   unsigned jobs_;		// Von make vorgegebene Parallelität (-jN) oder 0
+private:
+   int wfd_;			// Zum Zurückgeben der Tokens
+   bool toggle_;		// O_NONBLOCK nur während «read()» setzen
+   char *held_;			// Gelesene Tokens (werden unverändert zurückgegeben)
+   size_t n_held_;
+   size_t max_held_;
+   const char *makeflags_;	// Für lokale Skripte
+   bool own_;			// Selbst erzeugt, siehe «resize()»
+   unsigned tokens_;		// Anzahl der Tokens im eigenen Jobserver
+   unsigned limit_;		// Eigener Jobserver: -jN in «makeflags_», ...
+   Str flags_;			// ... davor die geerbten MAKEFLAGS ...
+   Str auth_;			// ... dahinter --jobserver-auth
+   TokenQueue(int rfd, int wfd, bool toggle, const char *makeflags);
+   bool read_token(char *c);
+   static TokenQueue *create();
+   int handle_input(int fd, int events);
+};
+
+
 // Ein Skript, das durch einen Server ausgführt wird
 struct RemoteJob {
    Script *script_;
+   bool batch_;				// Server führt alle Blöcke selbständig aus ('B')
    RemoteJob *next_;
    RemoteJob **prev_;
 
@@ -136,29 +385,66 @@ struct RemoteJob {
 };
 
 
+// Beobachtete Leistung eines Servers. Wird in der Statusdatei gespeichert (siehe
+// «job_write_server_stats()») und bleibt auch für Server erhalten, die zur Zeit nicht in yabu.cfg
+// stehen.
+
+struct ServerStats;
+static ServerStats *server_stats = 0;
+static size_t n_server_stats = 0;
+
+struct ServerStats {
+   const char *host_;
+   double speed_;		// Laufzeit relativ zur lokalen Ausführung (0: unbekannt)
+   unsigned latency_;		// Dauer der Anmeldung in ms (0: unbekannt)
+   static ServerStats *get(const char *host);
+   static size_t index(const char *host) { return get(host) - server_stats; }
+};
+
+
 // Warteschlange für einen Yabu-Server
 
 struct Server: public PollObj {
-   Server(const char *cfg, const char *host, struct sockaddr_in const *addr,
+   Server(const char *cfg, const char *host, struct sockaddr_storage const *addr,
 	 unsigned max_jobs, unsigned prio);
    void connect();
    void shutdown(int err);
    static void cancel_connecting();
-   static bool select_queues(Project *prj, unsigned char *qmask, const char *cfg);
+   static bool select_queues(Project *prj, QueueMask &qmask, const char *cfg);
    static void start_jobs_all();
    static void shutdown_all();
+   static void cancel_jobs_all();
+   static bool reload(const char *cfg, const char *host, struct sockaddr_storage const *addr,
+	 unsigned max_jobs, unsigned prio);
+   void cancel_job(Script const *s);
+   void revive();
+   double speed() const;
+   double cost() const;
+   unsigned slots() const { return limit_ < max_jobs_ ? limit_ : max_jobs_; }
+   void update_stats(Target *t, unsigned long ms);
+   ServerStats *stats() const { return server_stats + stats_; }
    unsigned const qid_;
-   const char * const cfg_;
+   const char * cfg_;
    const char * const host_;
-   const struct sockaddr_in addr_;
-   const unsigned max_jobs_;
-   const unsigned prio_;
+   const struct sockaddr_storage addr_;
+   unsigned max_jobs_;
+   unsigned limit_;		// Vom Server gemeldete Plätze ('L') oder UINT_MAX
+   unsigned load_;		// Vom Server gemeldete Last mal 100
+   unsigned prio_;
    enum { CREATED, CONNECTING, LOGIN, READY, DEAD } state_;
    IoBuffer iob_;
    bool idle_;			// Nichts zu tun
+   bool removed_;		// Nicht mehr in yabu.cfg, nur noch laufende Skripte beenden
+   bool seen_;			// In yabu.cfg gefunden, siehe «job_reload_begin()»
 private:
    unsigned n_jobs_;
    RemoteJob *head_;
+   unsigned long connect_ms_;	// Beginn des Verbindungsaufbaus, siehe «sys_time_ms()»
+   unsigned backoff_ms_;	// Wartezeit bis zum nächsten Verbindungsversuch
+   unsigned long retry_ms_;	// Zeitpunkt des nächsten Verbindungsversuchs oder 0
+   unsigned failures_;		// Verbindungsabbrüche seit der letzten erfolgreichen Anmeldung
+   bool retrying_;		// Ausgefallen, wartende Skripte behalten die Warteschlange
+   size_t stats_;		// Index in «server_stats», einmal ermittelt statt je Auswahl
 
    int handle_connect(int fd);
    int handle_input(int fd, int events);
@@ -167,9 +453,13 @@ private:
    RemoteJob *add_job(Script *s);
    RemoteJob *find_job(unsigned jid);
    bool do_next_chunk(RemoteJob *j, bool prev_ok);
+   void send_env(Script const *s);
+   void send_build_size();
+   unsigned sent_size_;		// Zuletzt gemeldete Größe des Builds ('N')
 };
 
-static Server *servers[MAX_SERVERS];
+static Server **servers = 0;			// Alle Server, Index = «qid_»
+static const size_t MAX_QUEUED = 1024 * 1024;	// Sendepuffer je Server, siehe «start_job()»
 static size_t n_servers = 1;			// 0 ist die lokale Queue
 
 
@@ -178,6 +468,45 @@ static StringMap static_env;			// Globales Environment für alle Skripte
 static const char *auth_token = "";
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Unveränderliche Kopie von «static_env». Jeder Server erhält eine Kopie nur einmal je Verbindung
+// ('S'), danach überträgt «Server::send_env()» für jedes Skript nur die Abweichungen. Ändert sich
+// «static_env» (!export), legt «current()» beim nächsten Skript eine neue Kopie an. Die alten
+// bleiben für bereits erzeugte Skripte erhalten.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct EnvSnapshot {
+   unsigned const id_;
+   StringMap const env_;
+   QueueMask sent_;			// Server, die diese Kopie schon haben
+   EnvSnapshot *next_;
+   static EnvSnapshot *current();
+   static void changed() { cur = 0; }
+   static void forget(unsigned qid);
+private:
+   EnvSnapshot(unsigned id) :id_(id), env_(static_env), next_(all) { all = this; }
+   static EnvSnapshot *all;		// Alle Kopien
+   static EnvSnapshot *cur;		// Aktueller Stand oder 0
+};
+
+EnvSnapshot *EnvSnapshot::all = 0;
+EnvSnapshot *EnvSnapshot::cur = 0;
+
+EnvSnapshot *EnvSnapshot::current()
+{
+   if (cur == 0)
+      cur = new EnvSnapshot(all ? all->id_ + 1 : 1);
+   return cur;
+}
+
+// Nach Verbindungsabbruch: Der Server hat alle Kopien vergessen
+void EnvSnapshot::forget(unsigned qid)
+{
+   for (EnvSnapshot *e = all; e; e = e->next_)
+      e->sent_.clear(qid);
+}
+
+
 
 
 
@@ -191,15 +520,18 @@ static unsigned last_id = 0;
 Script::Script(Project *prj, Target *tgt, char tag, Str const &cmds, unsigned flags)
    :id_(++last_id), tgt_(tgt),
     no_exec_((flags & EXEC_LOCAL) ? false : no_exec), cmds_(cmds), flags_(flags),
-    prj_(prj), tag_(tag),
-    env_(static_env),
-    host_(0), next_(0), prevp_(wtail), chunk_(0), rp_(0),
-    saved_char_(0)
+    prj_(prj), pools_(0), prio_(~0UL), fan_out_(0), tag_(tag),
+    snap_(EnvSnapshot::current()), env_(snap_->env_),
+    host_(0), start_ms_(0), qid_(-1), retries_(0), twin_(0), spec_(false), discard_(false),
+    rl_(0), next_(0), prevp_(0), chunk_(0), rp_(0), saved_char_(0)
 {
-   memset(qmask_,0,sizeof(qmask_));
+   // Auto-Depend- und lokale Skripte haben Vorrang, weil Build-Skripte auf sie warten.
+   if (tgt && tag == 'b') {
+      pools_ = Pool::lookup(tgt->name_);
+      prio_ = tgt->critical_path();
+      fan_out_ = tgt->fan_out();
+   }
    rp_ = cmds_.data();
-   *wtail = this;		// An W-Liste anhängen
-   wtail = &next_;
    ++count;
    Message(MSG_3,"%s {%u}: CREATED",tgt ? tgt->name_ : "-",id_ );
 }
@@ -212,10 +544,18 @@ Script::Script(Project *prj, Target *tgt, char tag, Str const &cmds, unsigned fl
 Script::~Script()
 {
    YABU_ASSERT(count > 0);
-   YABU_ASSERT(prevp_ != 0 && *prevp_ == this);
+   YABU_ASSERT(prevp_ == 0 || *prevp_ == this);
    YABU_ASSERT(next_ == 0 || next_->prevp_ == &next_);
-   unlink();
+   if (prevp_ != 0)
+      unlink();
+   if (twin_)
+      twin_->twin_ = 0;
    notify(NOTIFY_FAILED);	// Falls noch nicht ausgeführt
+   if (pools_) {
+      for (PoolUse *u = pools_; qid_ >= 0 && u->pool_; ++u)
+	 u->pool_->release(qid_,u->weight_);
+      free(pools_);
+   }
    --count;
 }
 
@@ -228,7 +568,7 @@ bool Script::init()
 {
    setup_env();
    if (flags_ & EXEC_LOCAL) {
-      qmask_[0] = 1;
+      qmask_.set(0);
       idle = false;
    } else if (!Server::select_queues(prj_, qmask_,tgt_ ? tgt_->build_cfg_ : var_current_cfg(prj_->vscope())  )) {
       // Vermeide aufeinanderfolgende Meldungen zur gleichen Konfiguration
@@ -240,25 +580,58 @@ bool Script::init()
       notify(NOTIFY_CANCELLED);		// Besitzer benachrichtigen
       return false;
    }
+   enqueue();
    return true;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sortiert das Skript gemäß «qmask_» in die passende W-Liste ein, und zwar hinter allen Skripten
+// mit mindestens gleicher Priorität. Bei gleicher Priorität gewinnt das ältere Skript, neue Skripte
+// landen also meist am Ende; das prüfen wir zuerst, statt die ganze Liste zu durchlaufen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Script::enqueue()
+{
+   YABU_ASSERT(prevp_ == 0);
+   rl_ = ReadyList::get(&rl_head,qmask_);
+   Script **pp = &rl_->head_;
+   if (rl_->last_ && !precedes(rl_->last_))
+      pp = rl_->tail_;
+   else {
+      while (*pp && !precedes(*pp))
+	 pp = &(*pp)->next_;
+   }
+   prevp_ = pp;
+   next_ = *pp;
+   *pp = this;
+   if (next_)
+      next_->prevp_ = &next_;
+   else {
+      rl_->tail_ = &next_;
+      rl_->last_ = this;
+   }
+   ++n_waiting;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Bricht alle wartenden Skripte ab
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Script::cancel_waiting()
 {
-   while (whead) {
-      whead->notify(NOTIFY_CANCELLED);
-      delete whead;
+   for (ReadyList *rl = rl_head; rl; rl = rl->next_) {
+      while (Script *s = rl->head_) {
+	 s->notify(NOTIFY_CANCELLED);
+	 delete s;
+      }
    }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Skript-Environment festlegen. Der Konstruktor initialisert das Environment wird mit «static_env».
+// Skript-Environment festlegen. Der Konstruktor initialisert das Environment mit «static_env».
 // Hier setzen wir weitere Variablen, die konfigurationsabhängig und für jedes Skript verschieden
 // sein können.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -291,21 +664,72 @@ void Script::setup_env()
 
 void Script::clear_queue_mask(unsigned qid)
 {
-   unsigned idx = qid / 8;
-   unsigned bit = 1 << (qid % 8);
-   Script *s = whead;
-   while (s) {
-      Script *n = s->next_;
-      s->qmask_[idx] &= ~bit;	// Bit löschen
-      
-      if (!memcmp(s->qmask_,EMPTY_MASK,sizeof(EMPTY_MASK))) {
-         s->notify(NOTIFY_CANCELLED); // Keine Warteschlange mehr verfügbar
-	 delete s;
-      } 
-      else if (!memcmp(s->qmask_,LOCAL_MASK,sizeof(LOCAL_MASK)))
-	 idle = false;		// Skript ist lokal ausführbar geworden
+   for (ReadyList *rl = rl_head; rl; rl = rl->next_) {
+      if (!rl->mask_.test(qid))
+	 continue;
+
+      // Liste leeren und die Skripte mit der neuen Maske neu einsortieren
+      Script *s = rl->head_;
+      rl->head_ = 0;
+      rl->tail_ = &rl->head_;
+      rl->last_ = 0;
+      while (s) {
+	 Script *n = s->next_;
+	 s->prevp_ = 0;
+	 s->next_ = 0;
+	 s->rl_ = 0;
+	 --n_waiting;
+	 s->qmask_.clear(qid);		// Bit löschen
+
+	 if (s->qmask_.empty()) {
+	    s->notify(NOTIFY_CANCELLED); // Keine Warteschlange mehr verfügbar
+	    delete s;
+	 } else {
+	    if (s->qmask_.local_only())
+	       idle = false;		// Skript ist lokal ausführbar geworden
+	    s->enqueue();
+	 }
+	 s = n;
+      }
+   }
+}
+
 
-      s = n;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bestimmt die Warteschlangen aller wartenden Skripte neu, nachdem sich die Server-Liste geändert
+// hat. Neue Server werden so auch für schon wartende Skripte benutzbar. Lokale Skripte und
+// spekulative Kopien behalten ihre Maske ohne die entfernten Server.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Script::reselect_all()
+{
+   Script *list = 0;
+   Script **tail = &list;
+   for (ReadyList *rl = rl_head; rl; rl = rl->next_) {
+      while (Script *s = rl->head_) {
+	 s->unlink();
+	 *tail = s;
+	 tail = &s->next_;
+      }
+   }
+   while (Script *s = list) {
+      list = s->next_;
+      s->next_ = 0;
+      bool ok;
+      if ((s->flags_ & EXEC_LOCAL) || s->spec_ || s->tgt_ == 0) {
+	 for (unsigned i = 1; i < n_servers; ++i) {
+	    if (servers[i]->removed_)
+	       s->qmask_.clear(i);
+	 }
+	 ok = !s->qmask_.empty();
+      } else
+	 ok = Server::select_queues(s->prj_,s->qmask_,s->tgt_->build_cfg_);
+      if (ok)
+	 s->enqueue();
+      else {
+	 s->notify(NOTIFY_CANCELLED);	// Keine Warteschlange mehr verfügbar
+	 delete s;
+      }
    }
 }
 
@@ -329,7 +753,7 @@ unsigned Script::count_active()
 
 bool Script::empty()
 {
-   return Script::whead == 0 && Script::ahead == 0;
+   return Script::n_waiting == 0 && Script::ahead == 0;
 }
 
 
@@ -357,12 +781,20 @@ void Script::unlink()
    if (next_)
       next_->prevp_ = prevp_;
    if ((*prevp_ = next_) == 0) {
-      // «this» war das letzte Element der Liste. D.h., entweder «wtail» oder «atail» zeigt
+      // «this» war das letzte Element der Liste. D.h., entweder «rl_->tail_» oder «atail» zeigt
       // auf «next_» und muß angepaßt werden.
-      if (wtail == &next_) wtail = prevp_;
-      else if (atail == &next_) atail = prevp_;
+      if (rl_ && rl_->tail_ == &next_) {
+	 rl_->tail_ = prevp_;
+	 rl_->last_ = 0;		// Vorgänger unbekannt
+      } else if (atail == &next_) atail = prevp_;
       else YABU_ASSERT(false);
    }
+   if (rl_) {
+      rl_ = 0;
+      --n_waiting;
+   }
+   prevp_ = 0;
+   next_ = 0;
 }
 
 
@@ -372,9 +804,13 @@ void Script::unlink()
 
 void Script::activate(unsigned qid)
 {
-   YABU_ASSERT(is_in_list(whead));
+   YABU_ASSERT(rl_ != 0);
 
    host_ = qid == 0 ? 0 : servers[qid]->host_;
+   qid_ = qid;
+   start_ms_ = sys_time_ms();
+   for (PoolUse *u = pools_; u && u->pool_; ++u)
+      u->pool_->acquire(qid,u->weight_);
 
    // Aus aktueller Liste entfernen...
    unlink();
@@ -392,12 +828,14 @@ void Script::activate(unsigned qid)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Sucht das nächste ausführbare Skript für die Warteschlange »queue» und stellt das Skript in die
-// A-Liste.
+// A-Liste (außer bei «activate» = false). Ist «max_ms» > 0, kommen nur Skripte mit höchstens dieser
+// erwarteten Laufzeit in Frage.
 // Die Warteschlange 0 (lokale Ausführung) hat niedrigere Priorität, d.h., ein Skript, das
-// mindestens einem Server zugeordnet ist, wird niemals lokal ausgeführt.
+// mindestens einem Server zugeordnet ist, wird nur dann lokal ausgeführt, wenn es keine nur lokal
+// ausführbaren Skripte gibt und «local_steal» es erlaubt.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Script *Script::find(unsigned queue)
+Script *Script::find(unsigned queue, bool activate, unsigned long max_ms)
 {
    YABU_ASSERT(queue < n_servers);
 
@@ -405,20 +843,71 @@ Script *Script::find(unsigned queue)
    if (!parallel_build && ahead != 0)
       return 0;
 
+   // Jede W-Liste ist sortiert, es genügt also, die jeweils erste passende Skripte zu vergleichen.
+   // Das erste Skript paßt immer, außer wenn ein Pool (!pool) voll ist.
    Script *j = 0;
-   if (queue == 0) {
-      for (j = whead; j && memcmp(LOCAL_MASK,j->qmask_,(n_servers + 7) / 8); j = j->next_);
-   } else {
-      size_t const idx = queue / 8;
-      size_t const bit = 1 << (queue % 8);
-      for (j = whead; j && (j->qmask_[idx] & bit) == 0; j = j->next_);
+   for (ReadyList *rl = rl_head; rl; rl = rl->next_) {
+      if (queue == 0 ? !rl->mask_.local_only() : !rl->mask_.test(queue))
+	 continue;
+      Script *s;
+      for (s = rl->head_; s && (!s->fits(queue) || !s->is_short(max_ms)); s = s->next_);
+      if (s && (j == 0 || s->precedes(j)))
+	 j = s;
+   }
+
+   // Freie lokale Plätze übernehmen Skripte, die auf einen Server warten
+   if (j == 0 && queue == 0 && local_steal != StealSetting::NO) {
+      for (ReadyList *rl = rl_head; rl; rl = rl->next_) {
+	 if (!rl->mask_.test(0))
+	    continue;
+	 for (Script *s = rl->head_; s; s = s->next_) {
+	    if (!s->fits(0))
+	       continue;
+	    if (j == 0 || (local_steal == StealSetting::SHORT
+		     ? s->tgt_ && j->tgt_
+		       && s->tgt_->expected_duration() < j->tgt_->expected_duration()
+		     : s->precedes(j)))
+	       j = s;
+	    if (local_steal != StealSetting::SHORT)
+	       break;			// Nur das erste passende Skript jeder Liste
+	 }
+      }
    }
-   if (j)
+
+   if (j && activate)
       j->activate(queue);
    return j;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reihenfolge in der W-Liste: true, wenn «this» vor «s» ausgeführt werden soll.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Script::precedes(Script const *s) const
+{
+   if (prio_ != s->prio_)
+      return prio_ > s->prio_;
+   if (fan_out_ != s->fan_out_)
+      return fan_out_ > s->fan_out_;
+   return id_ < s->id_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prüft, ob alle Pools des Skriptes in der Warteschlange «qid» genug Platz haben.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Script::fits(unsigned qid) const
+{
+   for (PoolUse const *u = pools_; u && u->pool_; ++u) {
+      if (!u->pool_->fits(qid,u->weight_))
+	 return false;
+   }
+   return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Zerlegt das Skript in einzelne ausführbare Blöcke. Ein Block wird durch '{' und '}' (jeweils 
 // allein in einer Zeile) gebildet. Die Klammern werden nicht Teil des Blocks. Verschachtelte 
@@ -426,63 +915,126 @@ Script *Script::find(unsigned queue)
 // jede Zeile als eigener Block.
 // Beginnt die erste Zeile des Skriptes mit '#!', dann bilden die restlichen Zeilen einen einzigen
 // Block.
-// return: True: nächster Block bereit. False: Ende des Skripts erreicht.
+// rp: Beginn des nächsten Blocks, wird weitergesetzt. Der Block wird mit NUL abgeschlossen, das
+//    überschriebene Zeichen steht in «saved» und wird beim nächsten Aufruf wiederhergestellt.
+// error: wird bei fehlender '}' gesetzt
+// return: Nächster Block oder 0, wenn das Ende des Skripts erreicht ist.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool Script::next_chunk()
+static char *split_chunk(char *&rp, char &saved, bool *error)
 {
-   if (saved_char_ > 0 && rp_ != 0) 
-      *rp_ = saved_char_;
-   if (rp_ == 0 || skip_blank(&rp_) == 0) {
-      chunk_ = rp_ = 0;
-      return false;
+   if (saved != 0 && rp != 0) 
+      *rp = saved;
+   if (rp == 0 || skip_blank(&rp) == 0) {
+      rp = 0;
+      return 0;
    }
 
-   chunk_ = rp_;
-   if (rp_[0] == '#' && rp_[1] == '!') 		// #!... --> Rest ist ein Block
-      rp_ = 0;
-   else if (*rp_ == '{' && rp_[1] == '\n') {	// Mehrzeiliger Block { ... }
+   char *chunk = rp;
+   if (rp[0] == '#' && rp[1] == '!') 		// #!... --> Rest ist ein Block
+      rp = 0;
+   else if (*rp == '{' && rp[1] == '\n') {	// Mehrzeiliger Block { ... }
       int level = 1;
-      chunk_ = (rp_ += 2);
-      while (level > 0 && *rp_) {
-         while (*rp_ != 0 && *rp_ != '\n') ++rp_;
-         if (rp_[-1] == '{')
+      chunk = (rp += 2);
+      while (level > 0 && *rp) {
+         while (*rp != 0 && *rp != '\n') ++rp;
+         if (rp[-1] == '{')
             ++level;
-         else if (rp_[-1] == '}' && --level == 0)
-            rp_[-1] = 0;
-         if (*rp_ != 0) ++rp_;                  // Nächste Zeile
+         else if (rp[-1] == '}' && --level == 0)
+            rp[-1] = 0;
+         if (*rp != 0) ++rp;                  // Nächste Zeile
       }
       if (level > 0) {
-	 YUERR(S02,nomatch("{","}"));
-	 chunk_ = rp_ = 0;
-	 return false;
+	 *error = true;
+	 rp = 0;
+	 return 0;
       }
-   } else if (*rp_ == '|') {			// '|'-Syntax
-      chunk_ = ++rp_;
-      char *wp = rp_;
+   } else if (*rp == '|') {			// '|'-Syntax
+      chunk = ++rp;
+      char *wp = rp;
       while (true) {
-	 while (*rp_ != 0 && *rp_ != '\n') *wp++ = *rp_++;
-	 if (*rp_ == '\n') {
-	    *wp++ = *rp_++;
-	    while (*rp_ == ' ' || *rp_ == '\t') ++rp_;
-	    if (*rp_ != '|') {
+	 while (*rp != 0 && *rp != '\n') *wp++ = *rp++;
+	 if (*rp == '\n') {
+	    *wp++ = *rp++;
+	    while (*rp == ' ' || *rp == '\t') ++rp;
+	    if (*rp != '|') {
 	       wp[-1] = 0;
 	       break;
 	    }
-	    ++rp_;
+	    ++rp;
 	 }
       }
    } else {					// Einzelne Zeile
-      while (*rp_ != 0 && *rp_ != '\n')
-         ++rp_;
-      if (*rp_ != 0)
-         ++rp_;
+      while (*rp != 0 && *rp != '\n')
+         ++rp;
+      if (*rp != 0)
+         ++rp;
    }
-   if (rp_) {
-      saved_char_ = *rp_;
-      *rp_ = 0;					// Block mit NUL abschließen
+   if (rp) {
+      saved = *rp;
+      *rp = 0;					// Block mit NUL abschließen
    }
-   return true;
+   return chunk;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Nächsten Block des Skripts bereitstellen, siehe «split_chunk()».
+// return: True: nächster Block bereit. False: Ende des Skripts erreicht.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Script::next_chunk()
+{
+   bool error = false;
+   chunk_ = split_chunk(rp_,saved_char_,&error);
+   if (error)
+      YUERR(S02,nomatch("{","}"));
+   return chunk_ != 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Schreibt den aktuellen und alle folgenden Blöcke, jeweils mit NUL abgeschlossen, nach «buf».
+// Der Zustand von «next_chunk()» bleibt unverändert, wir zerlegen dazu eine Kopie des Rests.
+// Einen fehlerhaften Block meldet später «next_chunk()».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Script::remaining_chunks(Str &buf) const
+{
+   buf.append(chunk(),strlen(chunk()) + 1);
+   if (rp_ == 0 || saved_char_ == 0)
+      return;
+   Str rest(&saved_char_,1);
+   rest.append(rp_ + 1);
+   char *rp = rest.data();
+   char saved = 0;
+   bool error = false;
+   while (char const *c = split_chunk(rp,saved,&error))
+      buf.append(c,strlen(c) + 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fortschrittsanzeige möglich: stdout ist ein Terminal, «progress» ist gesetzt, kein -q.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool progress_enabled()
+{
+   static int tty = -1;
+   if (tty < 0)
+      tty = isatty(1) ? 1 : 0;
+   return tty && show_progress && verbosity >= 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Schreibt yabu die Ausgaben der Skripte selbst? Das ist nötig bei «max_output_lines» ungleich 0
+// und bei der Fortschrittsanzeige, weil sonst Ausgaben der Skripte hinter ihrer Zeile landen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool collect_output()
+{
+   return max_output_lines != 0 || progress_enabled();
 }
 
 
@@ -525,6 +1077,7 @@ static void output(Str &o)
       ADDIO(txt,len);		// «max_lines» = 0: alles ausgeben
 
    if (end[-1] != '\n') ADDIO("\n",1);
+   job_progress_clear();
    writev(1,iov,nio);
    o.clear();
 }
@@ -544,7 +1097,13 @@ static void echo(const char *script)
 
 bool Script::next_step(bool prev_ok)
 {
-   if ((flags_ & EXEC_COLLECT_OUTPUT) == 0)
+   if (discard_) {		// Die andere Kopie war schneller
+      obuf_.clear();
+      return false;
+   }
+
+   // Eine spekulative Kopie gibt ihre Ausgaben erst aus, wenn feststeht, daß sie gewinnt.
+   if ((flags_ & EXEC_COLLECT_OUTPUT) == 0 && !spec_)
       output(obuf_);
 
    YabuContext yctx(tgt_ && tgt_->build_rule_ ?tgt_->build_rule_->srcline_ : 0,tgt_,0);
@@ -561,12 +1120,86 @@ bool Script::next_step(bool prev_ok)
    if (prev_ok && chunk_ != 0)
       return true;
 
-   // Fehler oder Ende des Skriptes erreicht.
+   // Fehler oder Ende des Skriptes erreicht. Bei spekulativer Ausführung gewinnt die erste
+   // erfolgreiche Kopie. Scheitert eine Kopie, entscheidet die andere.
+   if (Script *const o = twin_) {
+      twin_ = o->twin_ = 0;
+      if (!prev_ok) {
+	 discard_ = true;
+	 obuf_.clear();
+	 return false;
+      }
+      o->discard();
+   }
+   if (spec_ && (flags_ & EXEC_COLLECT_OUTPUT) == 0)
+      output(obuf_);
    notify(prev_ok ? NOTIFY_OK : NOTIFY_FAILED);
    return false;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Verwirft eine Kopie bei spekulativer Ausführung. Eine wartende Kopie wird sofort gelöscht, ein
+// laufendes Skript abgebrochen. Ein Server, der 'K' nicht kennt, führt den aktuellen Block noch zu
+// Ende, danach bricht «next_step()» ab.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Script::discard()
+{
+   discard_ = true;
+   Message(MSG_2,"%s {%u}: DISCARDED",tgt_ ? tgt_->name_ : "-",id_);
+   if (rl_ != 0)
+      delete this;
+   else if (qid_ == 0)
+      Job::kill_script(this);
+   else if (qid_ > 0)
+      servers[qid_]->cancel_job(this);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Spekulative Ausführung (speculate > 0): Wenn keine Skripte mehr warten, starten wir für jedes
+// Build-Skript, das schon länger als «speculate» Prozent seiner bekannten Laufzeit läuft, eine
+// zweite Kopie auf einer anderen Warteschlange. Die Kopie hat die niedrigste Priorität, so daß sie
+// keinem regulären Skript einen Platz wegnimmt. Ziele mit Seiteneffekten schließt !nospeculate aus.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Script::speculate()
+{
+   if (::speculate == 0 || n_waiting > 0 || exit_code > 1 || !parallel_build)
+      return;
+   unsigned long const now = sys_time_ms();
+   StringList dummy;
+   for (Script *s = ahead; s; s = s->next_) {
+      if (   s->tag_ != 'b' || s->twin_ || s->discard_ || s->no_exec_ || s->tgt_->duration_ == 0
+	  || now - s->start_ms_ <= (unsigned long) s->tgt_->duration_ * ::speculate / 100)
+	 continue;
+      QueueMask mask(s->qmask_);
+      mask.clear(s->qid_);
+      if (mask.empty())
+	 continue;			// Keine andere Warteschlange
+      size_t i;
+      for (i = 0; i < no_speculate.size() && !dummy.match('%',no_speculate[i],s->tgt_->name_); ++i);
+      if (i < no_speculate.size())
+	 continue;
+
+      Script *t = new Script(s->prj_,s->tgt_,'b',s->tgt_->build_script_,s->flags_);
+      t->qmask_ = mask;
+      t->setup_env();
+      t->prio_ = 0;
+      t->spec_ = true;
+      t->twin_ = s;
+      s->twin_ = t;
+      t->enqueue();
+      for (unsigned k = 1; k < n_servers; ++k) {
+	 if (mask.test(k))
+	    servers[k]->idle_ = false;
+      }
+      idle = false;
+   }
+}
+
+
 static const char *event_str(notify_event_t event)
 {
    switch (event)
@@ -585,11 +1218,27 @@ static const char *event_str(notify_event_t event)
 
 void Script::notify(notify_event_t event)
 {
+   if (discard_)
+      return;
+   if (spec_ && event == NOTIFY_STARTED) {
+      MSG(MSG_0,Msg::building(tgt_,host_," [speculative]"));
+      return;
+   }
    if (prj_) {
       // Versuche, Störungen durch NFS-Caching zu vermeiden
       if (event == NOTIFY_OK && host_ && !tgt_->is_alias_)
 	 yabu_cot(tgt_->name_);
 
+      // Laufzeit für die Planung künftiger Builds merken. Bei Servern rechnen wir auf lokale
+      // Ausführung um.
+      if (event == NOTIFY_OK && tag_ == 'b' && tgt_ && start_ms_ != 0 && !no_exec_) {
+	 unsigned long const ms = sys_time_ms() - start_ms_;
+	 if (qid_ > 0)
+	    servers[qid_]->update_stats(tgt_,ms);
+	 else
+	    tgt_->set_duration(ms);
+      }
+
       Str *o = (event != NOTIFY_STARTED && (flags_ & EXEC_COLLECT_OUTPUT)) ? &obuf_ : 0;
       Message(MSG_3,"%s {%u}: %s",tgt_ ? tgt_->name_ : "-",id_, event_str(event));
       prj_->job_notify(tgt_,tag_,event,host_,o);
@@ -609,11 +1258,62 @@ void Script::set_local_env()
    env_.set("YABU_SYSTEM",my_osname());
    env_.set("YABU_RELEASE",my_osrelease());
    env_.set("YABU_HOSTNAME",my_hostname());
+   if (TokenQueue *tq = TokenQueue::get())
+      env_.set("MAKEFLAGS",tq->makeflags());	// Jobserver für Unter-Builds
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stellt ein aktives Skript zurück in die W-Liste, nachdem die Warteschlange «qid» ausgefallen
+// ist. Das Skript beginnt dann später von vorn, auf einer anderen Warteschlange oder (mit «keep»)
+// nach dem erneuten Verbinden auch auf derselben.
+// keep: Die Warteschlange «qid» bleibt erlaubt (der Server wird erneut verbunden).
+// Return: false, wenn das nicht möglich ist (keine Warteschlange mehr, Neustarts erschöpft, Abbruch
+// des Builds). Der Aufrufer muß das Skript dann abbrechen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Script::requeue(unsigned qid, bool keep)
+{
+   YABU_ASSERT(rl_ == 0 && qid_ == (int) qid);
+   if (!keep)
+      qmask_.clear(qid);
+   if (exit_code > 1 || tgt_ == 0 || retries_ >= (unsigned) max_retries || qmask_.empty())
+      return false;
+
+   // Skript wiederherstellen. «next_chunk()» verändert «cmds_», deshalb nehmen wir das Original.
+   cmds_ = (tag_ == 'a') ? tgt_->ad_script_ : tgt_->build_script_;
+   rp_ = cmds_.data();
+   chunk_ = 0;
+   saved_char_ = 0;
+   obuf_.clear();
+   for (PoolUse *u = pools_; u && u->pool_; ++u)
+      u->pool_->release(qid_,u->weight_);
+   ++retries_;
+   Message(MSG_0,Msg::script_requeued(tgt_->name_,host_,retries_,max_retries));
+   host_ = 0;
+   qid_ = -1;
+   start_ms_ = 0;
+
+   unlink();
+   enqueue();
+   for (unsigned k = 1; k < n_servers; ++k) {
+      if (qmask_.test(k))
+	 servers[k]->idle_ = false;
+   }
+   if (qmask_.local_only() || local_steal != StealSetting::NO)
+      idle = false;
+   return true;
 }
 
 
 void Script::cancel()
 {
+   if (twin_) {			// Die andere Kopie läuft weiter
+      twin_->twin_ = 0;
+      twin_ = 0;
+      discard_ = true;
+      return;
+   }
    if (is_in_list(ahead))
       notify(NOTIFY_FAILED);
    else
@@ -637,19 +1337,93 @@ Job *Job::find_pid(pid_t pid)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Wartende Jobs starten, solange «max_active» nicht erreicht ist
+// Paßt die Anzahl lokaler Jobs an die Systemlast an. Ist einer der Grenzwerte «max_load»,
+// «max_cpu_pressure», «max_mem_pressure» oder «min_mem_available» überschritten, sinkt das Limit
+// schrittweise (bis auf 1), andernfalls steigt es wieder bis «limit». Gemessen wird höchstens
+// einmal pro Sekunde.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool throttled = false;		// Limit ist wegen Überlast reduziert
+
+static unsigned adapt_limit(unsigned limit)
+{
+   static unsigned cur = 0;
+   static time_t last = 0;
+   if (max_load == 0 && max_cpu_pressure == 0 && max_mem_pressure == 0 && min_mem_available == 0)
+      return limit;
+
+   if (cur == 0 || cur > limit)
+      cur = limit;
+   time_t const now = time(0);
+   if (now != last) {
+      last = now;
+      SysLoad sl;
+      sys_get_load(&sl);
+      bool const high =
+	    (max_load > 0 && sl.load1 > max_load)
+	 || (max_cpu_pressure > 0 && sl.cpu_psi > max_cpu_pressure)
+	 || (max_mem_pressure > 0 && sl.mem_psi > max_mem_pressure)
+	 || (min_mem_available > 0 && sl.mem_avail >= 0 && sl.mem_avail < min_mem_available);
+      if (high && cur > 1)
+	 --cur;
+      else if (!high && cur < limit)
+	 ++cur;
+   }
+   throttled = cur < limit;
+   return cur;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Maximale Anzahl gleichzeitiger lokaler Jobs: «local_jobs», falls gesetzt, sonst die Vorgabe von
+// «make -jN» (wenn yabu unter make läuft) oder «max_active». Das Ergebnis wird gemäß
+// «adapt_limit()» an die Systemlast angepaßt; Änderungen melden wir mit -v.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned local_limit()
+{
+   unsigned limit = local_jobs > 0 ? (unsigned) local_jobs : max_active;
+   TokenQueue *const tq = TokenQueue::get();
+   if (local_jobs == 0 && tq && tq->jobs_ > 0)
+      limit = tq->jobs_;			// Vorgabe von «make -jN»
+   limit = adapt_limit(limit);
+   if (tq)
+      tq->resize(limit);
+   static unsigned shown = 0;
+   if (limit != shown) {
+      Message(MSG_1,Msg::local_jobs(limit));
+      shown = limit;
+   }
+   return limit;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wartende Jobs starten, solange «local_limit()» nicht erreicht ist
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Job::start_jobs()
 {
    idle = true;
+   unsigned const limit = local_limit();
+   TokenQueue *const tq = TokenQueue::get();
    Script *s;
-   while (count < max_active && (s = Script::find(0)) != 0) {
+   while (count < limit && Script::find(0,false) != 0) {
+      // Der erste Job benutzt das implizite Token, alle weiteren brauchen eines vom Jobserver
+      bool const token = count > 0 && tq != 0;
+      if (token && !tq->get_token())
+	 break;				// «TokenQueue::handle_input()» weckt uns wieder
+      s = Script::find(0);
       idle = false;
       Job *j = new Job(s);
+      j->token_ = token;
       s->set_local_env();
       j->do_next_chunk(true);		// Ausführung starten
    }
+
+   // Bei Überlast später erneut versuchen (spätestens nach dem Timeout in «process_queue()»)
+   if (throttled && count >= limit)
+      idle = false;
 }
 
 
@@ -669,10 +1443,39 @@ Job::~Job()
    if ((*prevp_ = next_) == 0)
       tail = prevp_;
    --count;
+   if (token_)
+      TokenQueue::get()->return_token();
    delete script_;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Beendet den lokalen Prozeß eines verworfenen Skriptes (spekulative Ausführung).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Job::kill_script(Script const *s)
+{
+   for (Job *j = head; j; j = j->next_) {
+      if (j->script_ == s && j->pid_ > 1) {
+	 sys_kill_group(j->pid_,SIGTERM);
+	 j->del_fd();		// Nicht auf Ausgaben von Enkelprozessen warten
+      }
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Alle laufenden Skripte auffordern, sich zu beenden (SIGTERM an die Prozeßgruppe). Die Jobs
+// selbst bleiben bestehen, bis «reap_children()» das Ende meldet.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Job::terminate_all()
+{
+   for (Job *j = head; j; j = j->next_)
+      sys_kill_group(j->pid_,SIGTERM);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Alle Jobs abbrechen
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -680,8 +1483,7 @@ Job::~Job()
 void Job::cancel_all()
 {
    while (head) {
-      if (head->pid_ > 1)
-	 kill(head->pid_,SIGKILL);
+      sys_kill_group(head->pid_,SIGKILL);
       if (head->script_)
 	 head->script_->cancel();
       delete head;
@@ -720,14 +1522,19 @@ int Job::handle_input(int fd, int events)
 // shell: Shellprogramm.
 // arg1: Erstes Argument.
 // arg2: Zweites Argument oder 0.
+// script_fd: Deskriptor, der im Kindprozeß offen bleiben soll (FD_CLOEXEC löschen), oder -1.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Job::exec_shell(const char *shell, const char *dir, const char *arg1, const char *arg2)
+void Job::exec_shell(const char *shell, const char *dir, const char *arg1, const char *arg2,
+      int script_fd)
 {
    int pipefd;
-   int flags = script_->flags_;
-   if (max_output_lines != 0)
+   int flags = script_->flags_ | EXEC_NEW_PGRP;
+   if (collect_output()) {
       flags |= EXEC_COLLECT_OUTPUT;
+      if (max_output_lines == 0 && isatty(2))
+	 flags |= EXEC_MERGE_STDERR;	// Nur wegen der Fortschrittsanzeige: beides geht ans Terminal
+   }
    if (!yabu_fork(&pipefd,&pid_,flags))
       return;
    if (pid_ == 0) {
@@ -735,6 +1542,8 @@ void Job::exec_shell(const char *shell, const char *dir, const char *arg1, const
 	fprintf(stderr,"chdir(%s): %s\n", dir, strerror(errno));
 	_exit(127);
       }
+      if (script_fd >= 0)
+	 fcntl(script_fd,F_SETFD,0);
       char *argv[4];
       argv[0] = const_cast<char *>(strrchr(shell, '/'));
       argv[0] = argv[0] ? argv[0] + 1 : const_cast<char *>(shell);
@@ -752,7 +1561,7 @@ void Job::exec_shell(const char *shell, const char *dir, const char *arg1, const
 
 Job::Job(Script *script)
       : script_(script), next_(0), prevp_(tail),
-        pid_(-1)
+        pid_(-1), token_(false)
 {
    *tail = this;
    tail = &next_;
@@ -762,8 +1571,9 @@ Job::Job(Script *script)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Startet die Shell, um einen Skriptabschnitt auszuführen. Dabei sind zwei Fälle möglich:
 // - Beginnt «chunk» mit "#!", dann wird der Rest der ersten Zeile als Name der Shell
-//   interpretiert. Die übrigen Zeilen werden in eine temporäre Datei geschrieben, deren Name
-//   die Shell als erstens (und einziges) Argument erhält.
+//   interpretiert. Die übrigen Zeilen werden in eine anonyme Datei (memfd) oder, falls das
+//   System keine anbietet, in eine temporäre Datei geschrieben, deren Name die Shell als erstes
+//   (und einziges) Argument erhält.
 // - Andernfalls wird die Default-Shell «shell_prog» ausgeführt. Sie erhält zwei Argumente,
 //   "-c" und «chunk»
 // Siehe auch «exec_shell()».
@@ -779,10 +1589,20 @@ void Job::exec(const char *dir, char *chunk)
       if (*chunk != 0)
 	 *chunk++ = 0;
 
-      // Skript in temporäre Datei schreiben
+      // Skript möglichst in eine anonyme Datei im Hauptspeicher schreiben. Die Shell liest es
+      // dann über /proc/self/fd. Nur falls das nicht geht, eine temporäre Datei benutzen.
+      int fd = sys_memfd("yabu-script");
+      if (fd >= 0) {
+	 yabu_write(fd, chunk, strlen(chunk));
+	 char path[40];
+	 snprintf(path,sizeof(path),"/proc/self/fd/%d",fd);
+	 exec_shell(shell,dir,path,0,fd);
+	 close(fd);				// Das Kind hat eine eigene Kopie
+	 return;
+      }
       static unsigned job_id = 0;
       file_name_.printf("%s%x.%x",TMP_FILE_PREFIX,(unsigned)getpid(),++job_id);
-      int fd = open(file_name_, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+      fd = open(file_name_, O_WRONLY | O_CREAT | O_TRUNC, 0755);
       if (fd < 0)
 	 YUERR(G10,cannot_open(file_name_));
       yabu_write(fd, chunk, strlen(chunk));
@@ -853,7 +1673,7 @@ bool Job::reap_children(bool blocking)
       int fd = j->fd();
       if (fd >= 0)
 	 while (j->handle_input(fd,POLLIN | POLLHUP) == 0);
-      if (WIFSIGNALED(status))
+      if (WIFSIGNALED(status) && !j->script_->discarded() && exit_code < 2)
            MSG(MSG_W,Msg::script_terminated_on_signal(WTERMSIG(status)));
       if (!j->do_next_chunk(WIFEXITED(status) && WEXITSTATUS(status) == 0))
 	 job_finished = true;
@@ -876,6 +1696,8 @@ void job_shutdown()
 {
    Server::cancel_connecting();
    Script::cancel_waiting();
+   Job::terminate_all();
+   Server::cancel_jobs_all();
    time_t msgtime = time(0) + 2;
    time_t exptime = msgtime + 8;
    while (Script::count_active() > 0) {
@@ -904,12 +1726,18 @@ void Job::process_queue(bool wait)
 {
    do {
       if (exit_code <= 1) {
-	 if (!idle) start_jobs();
+	 // Server zuerst, damit lokale Plätze nur übernehmen, was die Server übrig lassen
+	 check_cfg_reload();
+	 Script::speculate();
 	 Server::start_jobs_all();
+	 if (!idle) start_jobs();
       } else
 	 wait = false;
+      Script::progress();
 
-      // Warte auf Input, falls nicht inzwischen ein SIGCHLD aufgetreten ist
+      // Warte auf Input, falls nicht inzwischen ein SIGCHLD aufgetreten ist. Mit signalfd
+      // (siehe «PollObj::watch_children()») weckt ein SIGCHLD «poll()» sofort auf; der Timeout
+      // ist dann nur noch eine Rückfallebene.
       bool poll_ok = PollObj::poll((got_sigchld || !wait) ? 0 : 2000);
       got_sigchld = false;
 
@@ -920,6 +1748,83 @@ void Job::process_queue(bool wait)
 
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fortschrittsanzeige: eine Zeile am Ende der Ausgabe, die mit «\r» überschrieben wird. Sie
+// erscheint, wenn stdout ein Terminal ist (siehe «progress_enabled()»); yabu schreibt dann alle
+// Ausgaben der Skripte selbst (siehe «collect_output()»). Sie wird höchstens zweimal pro Sekunde
+// erneuert. Vor jeder anderen Ausgabe löscht «job_progress_clear()» die Zeile. Die Zähler beziehen
+// sich auf die ausgewählten Ziele, nicht auf die bereits erzeugten Skripte, und während der
+// Auswahl zeigen wir nichts an, damit die Gesamtzahl nicht springt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool progress_shown = false;	// Fortschrittszeile ist sichtbar
+
+void job_progress_clear()
+{
+   if (progress_shown) {
+      progress_shown = false;
+      yabu_write(1,"\r\033[K",4);
+   }
+}
+
+
+void Script::progress()
+{
+   static unsigned long last = 0;
+   if (!progress_enabled())
+      return;
+   if (empty()) {
+      job_progress_clear();
+      return;
+   }
+   unsigned long const now = sys_time_ms();
+   if (last != 0 && now - last < 500)
+      return;
+   last = now;				// Auch die Prüfung auf laufende Auswahl nur zweimal pro Sekunde
+   for (Target const *t = Target::sel_head; t; t = t->sel_next_) {
+      if (t->status_ == Target::SELECTING)
+	 return;				// Auswahl läuft noch
+   }
+
+   // Laufende und wartende Skripte; für laufende Skripte zählt nur die Restzeit.
+   unsigned running = 0, waiting = 0;
+   unsigned long work = 0;
+   for (Script const *s = ahead; s; s = s->next_) {
+      if (s->tag_ != 'b') continue;
+      ++running;
+      unsigned long const d = s->tgt_->expected_duration();
+      if (d > now - s->start_ms_)
+	 work += d - (now - s->start_ms_);
+   }
+   for (ReadyList const *rl = rl_head; rl; rl = rl->next_) {
+      for (Script const *s = rl->head_; s; s = s->next_) {
+	 if (s->tag_ != 'b') continue;
+	 ++waiting;
+	 work += s->tgt_->expected_duration();
+      }
+   }
+
+   // Ausgewählte Ziele, für die noch kein Skript erzeugt wurde
+   for (Target const *t = Target::sel_head; t; t = t->sel_next_) {
+      if (t->build_rule_ == 0 || t->status_ == Target::BUILDING) continue;
+      work += t->expected_duration();
+   }
+
+   // Restzeit: verbleibende Arbeit verteilt auf die zur Zeit belegten Plätze
+   char eta[20] = "?";
+   if (Target::n_durations > 0) {
+      unsigned long const sec = work / (running > 0 ? running : 1) / 1000;
+      snprintf(eta,sizeof(eta),"%lu:%02lu",sec / 60,sec % 60);
+   }
+   Str line("\r");
+   line.append(Msg::progress(Target::n_sel_done,Target::n_sel_build,running,waiting,eta));
+   line.append("\033[K");
+   fflush(stdout);
+   yabu_write(1,line,line.len());
+   progress_shown = true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Gibt «true» zurück, wenn alle Warteschlangen leer sind.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -938,7 +1843,7 @@ bool job_queue_empty()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 RemoteJob::RemoteJob(Script *script, RemoteJob **head)
-   :script_(script), next_(*head), prev_(head)
+   :script_(script), batch_(false), next_(*head), prev_(head)
 {
    Message(MSG_2,"RemoteJob [%u]",script_->id_);
    *head = this;
@@ -958,12 +1863,15 @@ RemoteJob::~RemoteJob()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 Server::Server(const char *cfg, const char *host,
-      struct sockaddr_in const *addr, unsigned max_jobs, unsigned prio)
+      struct sockaddr_storage const *addr, unsigned max_jobs, unsigned prio)
    :qid_(n_servers), cfg_(str_freeze(cfg)), host_(str_freeze(host)), addr_(*addr),
-    max_jobs_(max_jobs), prio_(prio), state_(CREATED), iob_(*this),idle_(false),
-    n_jobs_(0), head_(0)
+    max_jobs_(max_jobs), limit_(UINT_MAX), load_(0), prio_(prio), state_(CREATED), iob_(*this),idle_(false),
+    removed_(false), seen_(true),
+    n_jobs_(0), head_(0), connect_ms_(0), backoff_ms_(0), retry_ms_(0), failures_(0),
+    retrying_(false),
+    stats_(ServerStats::index(host)), sent_size_(0)
 {
-   YABU_ASSERT(n_servers < MAX_SERVERS);
+   array_realloc(servers,n_servers + 1);
    servers[n_servers++] = this;
 }
 
@@ -976,10 +1884,17 @@ Server::Server(const char *cfg, const char *host,
 void Server::connect()
 {
    YABU_ASSERT(state_ == CREATED);
-   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   connect_ms_ = sys_time_ms();
+   sent_size_ = 0;
+   int fd = socket(addr_.ss_family, SOCK_STREAM, 0);
+   if (fd < 0) {
+      shutdown(errno);
+      return;
+   }
    add_fd(fd);
    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
-   int rc = ::connect(fd,(struct sockaddr *)&addr_,sizeof(addr_));
+   sys_tune_socket(fd,&addr_);
+   int rc = ::connect(fd,(struct sockaddr *)&addr_,sys_addr_len(&addr_));
    if (rc == 0) 				// «connect()» war sofort erfolgreich
       handle_connect(fd);
    else if (errno == EINPROGRESS) {		// «connect()» läuft
@@ -1006,32 +1921,63 @@ void Server::cancel_connecting()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Legt fest, welche Warteschlangen in der Konfiguration «cfg» benutzbar sind. Nach der
-// Rückkehr sind für alle zulässigen Warteschlangen die zugehörigen Bits in «qmask» auf 1 und
-// alle anderen Bits auf 0 gesetzt. Die Reihenfolge der Bits entspricht der in «servers»:
-// (qmask[0] & 0x01)  gehört zu servers[0], (qmask[0] & 0x80) gehört zu servers[7] und
-// (qmask[1] & 0x01) zu servers[8].
+// Rückkehr sind für alle zulässigen Warteschlangen die zugehörigen Bits in «qmask» gesetzt
+// und alle anderen Bits gelöscht. Die Bits entsprechen den Indizes in «servers».
 // Der Returnwert ist «true», wenn mindestens eine Warteschlange verfügbar ist.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool Server::select_queues(Project *prj, unsigned char *qmask, const char *cfg)
+struct CompatEntry {
+   VarScope *scope_;
+   const char *cfg_;				// Mit «str_freeze()» erzeugt
+   QueueMask mask_;				// Kompatible Warteschlangen
+   CompatEntry *next_;
+};
+
+static CompatEntry *compat_head = 0;		// Siehe «select_queues()»
+
+bool Server::select_queues(Project *prj, QueueMask &qmask, const char *cfg)
 {
+   // Die Kompatibilität hängt nur von der Konfiguration ab. Wir berechnen sie deshalb einmal je
+   // Konfiguration für alle Warteschlangen und merken uns das Ergebnis (bis zum nächsten
+   // «job_reload_end()»). Gleiche Konfigurationen können an verschiedenen Adressen stehen, wir
+   // vergleichen deshalb den Inhalt.
+   VarScope *const scope = prj->vscope();
+   if (cfg == 0) cfg = "";
+   CompatEntry *ce = compat_head;
+   for (; ce && (ce->scope_ != scope || strcmp(ce->cfg_,cfg)); ce = ce->next_);
+   if (ce == 0) {
+      ce = new CompatEntry;
+      ce->scope_ = scope;
+      ce->cfg_ = str_freeze(cfg);
+      ce->next_ = compat_head;
+      compat_head = ce;
+      for (size_t i = 1; i < n_servers; ++i) {
+	 if (var_cfg_compatible(scope,servers[i]->cfg_,cfg))
+	    ce->mask_.set(i);
+      }
+      if (var_cfg_compatible(scope,local_cfg,cfg))
+	 ce->mask_.set(0);
+   }
+
    bool success = false;
+   qmask.clear_all();
 
    // Server-Warteschlangen zuerst!
    for (size_t i = 1; i < n_servers; ++i) {
-      if (servers[i]->state_ != DEAD && var_cfg_compatible(prj->vscope(),servers[i]->cfg_,cfg)) {
+      if (   ce->mask_.test(i) && (servers[i]->state_ != DEAD || servers[i]->retrying_)
+	  && !servers[i]->removed_) {
 	 servers[i]->idle_ = false;
 	 success = true;
-	 qmask[i / 8] |= 1 << (i % 8);
+	 qmask.set(i);
 	 if (servers[i]->state_ == CREATED)
 	    servers[i]->connect();
       }
    }
 
    // Lokale Warteschlange.
-   if (var_cfg_compatible(prj->vscope(),local_cfg,cfg)) {
-      qmask[0] |= 1;
-      if (!success) {	
+   if (ce->mask_.test(0)) {
+      qmask.set(0);
+      if (!success || local_steal != StealSetting::NO) {	
 	 success = true;
 	 idle = false;		// Kein Server verfügbar --> sofort lokal ausführen
       }
@@ -1056,10 +2002,18 @@ bool Server::do_next_chunk(RemoteJob *j, bool prev_ok)
       return false;
    }
 
-   iob_.append('I',"%x",j->script_->id_);
+   if (j->batch_)			// Der Server hat den Block bereits
+      return true;
+   iob_.append_id('I',j->script_->id_);
    const char *root = j->script_->prj_->aroot_;
    iob_.append('D',"%s%s%s",yabu_wd, *root ? "/" : "",root);	// Verzeichnis
-   iob_.append('C',"%s",j->script_->chunk());
+   if (iob_.version() >= PROTO_BATCH) {
+      Str batch;
+      s.remaining_chunks(batch);
+      iob_.append('B',batch.len(),batch);
+      j->batch_ = true;
+   } else
+      iob_.append('C',"%s",j->script_->chunk());
    return true;
 }
 
@@ -1072,21 +2026,97 @@ void Server::shutdown_all()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Meldet dem Server die Größe des Builds ('N'), also die Anzahl der ausgewählten Ziele mit Regel.
+// Das ist eine obere Schranke für die Anzahl der Skripte; der Server entscheidet damit, ob der
+// Build "klein" ist («small=» in !users). Vor dem Ende der Auswahl (siehe «job_selection_done()»)
+// wäre die Zahl zu klein, deshalb melden wir erst danach und dann bei jeder Änderung.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool selection_done = false;
+
+void job_selection_done()
+{
+   selection_done = true;
+}
+
+void Server::send_build_size()
+{
+   unsigned const size = Target::n_sel_build;
+   if (   selection_done && state_ == READY && iob_.version() >= PROTO_BUILD_SIZE
+       && size != sent_size_) {
+      iob_.append('N',"%u",size);
+      sent_size_ = size;
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bricht ein laufendes Skript auf dem Server ab ('K'). Der Server beendet die Prozeßgruppe und
+// meldet das Ende wie gewohnt mit 'T'. Bis dahin bleibt der RemoteJob bestehen, so daß «n_jobs_»
+// mit der Belegung auf dem Server übereinstimmt. Ältere Server kennen 'K' nicht.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Server::cancel_job(Script const *s)
+{
+   if (state_ == READY && iob_.version() >= PROTO_CANCEL && find_job(s->id_) != 0)
+      iob_.append_id('K',s->id_);
+}
+
+
+void Server::cancel_jobs_all()
+{
+   for (unsigned i = 1; i < n_servers; ++i) {
+      for (RemoteJob *j = servers[i]->head_; j; j = j->next_)
+	 servers[i]->cancel_job(j->script_);
+   }
+}
+
+
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Neue Jobs auf allen verfügbaren Servern starten, soweit möglich.
-// TODO: Warteschlangen gemäß «max_active» und «prio» priorisieren
+// Neue Jobs auf allen verfügbaren Servern starten, soweit möglich. Jeder Job geht an den Server
+// mit der höchsten Priorität («prio=» in yabu.cfg), bei gleicher Priorität an den schnellsten (siehe
+// «cost()»), dann an den mit den meisten freien Plätzen (siehe «slots()») und zuletzt an den mit
+// der geringsten Last. Langsamere Server bekommen also nur Arbeit, wenn die schnelleren voll sind.
+// Da «Script::find()» die Skripte nach kritischem Pfad ausgibt, landen die längsten Ketten auf den
+// schnellsten Servern.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Server::start_jobs_all()
 {
-   for (bool idle = false; !idle; ) {
-      idle = true;
+   for (unsigned i = 1; i < n_servers; ++i) {
+      Server *const s = servers[i];
+      if (s->removed_ && s->n_jobs_ == 0 && s->state_ != DEAD)
+	 s->shutdown(0);		// Entfernter Server ist fertig
+      s->revive();
+      s->send_build_size();
+   }
+   for (;;) {
+      Server *best = 0;
       for (unsigned i = 1; i < n_servers; ++i) {
-	 servers[i]->start_job();
-	 idle &= servers[i]->idle_;
+	 Server *const s = servers[i];
+	 if (s->idle_)
+	    continue;
+	 if (s->state_ != READY || s->n_jobs_ >= s->slots() || s->removed_) {
+	    s->idle_ = true;
+	    continue;
+	 }
+	 if (best == 0 || s->prio_ > best->prio_) {
+	    best = s;
+	    continue;
+	 }
+	 if (s->prio_ < best->prio_)
+	    continue;
+	 double const c = s->cost(), bc = best->cost();
+	 unsigned const f = s->slots() - s->n_jobs_, bf = best->slots() - best->n_jobs_;
+	 if (c < bc || (c == bc && (f > bf || (f == bf && s->load_ < best->load_))))
+	    best = s;
       }
+      if (best == 0)
+	 break;
+      best->start_job();		// Setzt «idle_», falls kein passendes Skript wartet
    }
 }
 
@@ -1097,14 +2127,25 @@ void Server::start_jobs_all()
 
 void Server::start_job()
 {
+   // Ein deutlich langsamerer Server als der schnellste übernimmt nur kurze Skripte.
+   unsigned long max_ms = 0;
+   double fastest = 1.0;
+   for (unsigned i = 1; i < n_servers; ++i) {
+      if (servers[i]->state_ == READY && servers[i]->speed() < fastest)
+	 fastest = servers[i]->speed();
+   }
+   if (speed() > 1.5 * fastest && Target::n_durations > 0)
+      max_ms = Target::total_duration / Target::n_durations;
+
+   // Solange der Server die Daten nicht abnimmt, bekommt er keine weiteren Skripte.
    Script *script = 0;
-   if (idle_ || state_ != READY || n_jobs_ >= max_jobs_ || (script = Script::find(qid_)) == 0) {
+   if (   idle_ || state_ != READY || n_jobs_ >= slots() || iob_.pending() > MAX_QUEUED
+       || (script = Script::find(qid_,true,max_ms)) == 0) {
       idle_ = true;
    } else {
       ++n_jobs_;
       new RemoteJob(script,&head_);
-      for (char **ep = script->env(); *ep;  ++ep)
-	 iob_.append('E',"%s",*ep);
+      send_env(script);
       if (auto_mkdir && !script->tgt_->is_alias_) {
 	 const char *root = script->tgt_->prj_->aroot_;
 	 iob_.append('M',"%s%s%s%s",yabu_wd,*root ? "/" : "",root,script->tgt_->name_);
@@ -1114,6 +2155,36 @@ void Server::start_job()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Environment für das nächste Skript senden. Ältere Server erhalten jede Variable einzeln ('E'),
+// neuere einmal die Kopie von «static_env» ('S') und dann je Skript einen Verweis darauf ('J')
+// und die Variablen, die davon abweichen (YABU_TARGET usw.).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Server::send_env(Script const *s)
+{
+   if (iob_.version() < PROTO_ENV_SNAPSHOT) {
+      for (char **ep = s->env(); *ep;  ++ep)
+	 iob_.append('E',"%s",*ep);
+      return;
+   }
+
+   EnvSnapshot *const snap = s->snapshot();
+   if (!snap->sent_.test(qid_)) {
+      Str buf;
+      for (char **ep = snap->env_.env(); *ep;  ++ep)
+	 buf.append(*ep,strlen(*ep) + 1);
+      iob_.append_id('S',snap->id_,buf.len(),buf.data());
+      snap->sent_.set(qid_);
+   }
+   iob_.append_id('J',snap->id_);
+   for (char **ep = s->env(); *ep;  ++ep) {
+      if (!snap->env_.contains_entry(*ep))
+	 iob_.append('E',"%s",*ep);
+   }
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Verbindung nach «connect()» initialisieren
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1128,11 +2199,10 @@ int Server::handle_connect(int fd)
       shutdown(error);
       return 1;
    }
-   fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) & ~O_NONBLOCK);		// Wieder blockierend machen
 
    // Login
    state_ = LOGIN;
-   iob_.append('U',"%u %s",(unsigned)getuid(),auth_token);	// Login
+   iob_.append('U',"%u %s %u",(unsigned)getuid(),auth_token,PROTO_VERSION);	// Login
    return 0;
 }
 
@@ -1146,7 +2216,14 @@ int Server::handle_output(int fd, int events)
 {
    if (state_ == CONNECTING)
       return handle_connect(fd);	// connect() is abgeschlossen
-   iob_.write(fd);
+   size_t const before = iob_.pending();
+   int const rc = iob_.write(fd);
+   if (IoBuffer::failed(rc,errno)) {
+      shutdown(errno);
+      return 1;
+   }
+   if (before > MAX_QUEUED && iob_.pending() <= MAX_QUEUED)
+      idle_ = false;			// Wieder Skripte annehmen, siehe «start_job()»
    return 0;
 }
 
@@ -1166,7 +2243,10 @@ RemoteJob *Server::find_job(unsigned jid)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Verbindung zu einem Server schließen, wartende Skripte auf andere Server umleiten.
+// Verbindung zu einem Server schließen, wartende Skripte auf andere Server umleiten. Nach einem
+// Verbindungsabbruch («err» != 0) behalten die Skripte den Server in ihrer Maske und warten auf
+// die erneute Verbindung (siehe «revive()»). Erst wenn «max_reconnects» Versuche hintereinander
+// gescheitert sind, geben wir den Server für die wartenden Skripte auf.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Server::shutdown(int err)
@@ -1174,16 +2254,53 @@ void Server::shutdown(int err)
    if (state_ != DEAD) {
       state_ = DEAD;
       del_fd();
-      if (err != 0)
+      iob_.clear();
+      EnvSnapshot::forget(qid_);
+      n_jobs_ = 0;
+      limit_ = UINT_MAX;			// Neue Verbindung, evtl. zu einem älteren Server
+      load_ = 0;
+      if (err != 0) {
 	 Message(MSG_W,Msg::server_unavailable(host_,err));
 
-      // Aktive Jobs als gescheitert melden
+	 // Später erneut verbinden, mit exponentiell wachsendem Abstand
+	 backoff_ms_ = backoff_ms_ == 0 ? 1000 : backoff_ms_ < 150000 ? 2 * backoff_ms_ : 300000;
+	 retry_ms_ = sys_time_ms() + backoff_ms_;
+	 ++failures_;
+      }
+      retrying_ = err != 0 && !removed_ && exit_code <= 1 && failures_ <= (unsigned) max_reconnects;
+
+      // Aktive Jobs nach einem Verbindungsabbruch neu starten, sonst als gescheitert melden.
       while (head_) {
-	 head_->script_->cancel();
+	 Script *s = head_->script_;
+	 if (err != 0 && s->requeue(qid_,retrying_))
+	    head_->script_ = 0;
+	 else
+	    s->cancel();
 	 delete head_;
       }
 
-      Script::clear_queue_mask(qid_);
+      if (!retrying_)
+	 Script::clear_queue_mask(qid_);
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ausgefallenen Server nach Ablauf der Wartezeit wieder freigeben. Warten noch Skripte auf den
+// Server («retrying_»), verbinden wir sofort, sonst erst, wenn ein passendes Skript ansteht (siehe
+// «select_queues()»).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Server::revive()
+{
+   if (   state_ == DEAD && retry_ms_ != 0 && sys_time_ms() >= retry_ms_ && exit_code <= 1
+       && !removed_) {
+      Message(MSG_1,"%s: reconnect",host_);
+      retry_ms_ = 0;
+      state_ = CREATED;
+      idle_ = false;
+      if (retrying_)
+	 connect();
    }
 }
 
@@ -1197,37 +2314,60 @@ int Server::handle_input(int fd, int events)
     if (state_ == CONNECTING)			// Spezialfall: connect() fertig
        return handle_connect(fd);
     const int rc = iob_.read(fd);
+    int const err = errno;
     while (iob_.next()) {
        unsigned jid = 0;
        char how = '?';
        unsigned code = 0;
+       char const *out;
+       size_t out_len;
        if (iob_.tag_ == 'U') {
 	  if (*iob_.data_ == '+') {
-	     if (state_ == LOGIN) 
+	     if (state_ == LOGIN) {
 		state_ = READY;
+		unsigned version;
+		if (sscanf(iob_.data_ + 1,"%u",&version) == 1 && version <= PROTO_VERSION)
+		   iob_.set_version(version);
+		backoff_ms_ = 0;
+		failures_ = 0;
+		retrying_ = false;
+		ServerStats *const st = stats();
+		unsigned const ms = sys_time_ms() - connect_ms_ + 1;
+		st->latency_ = st->latency_ ? (3 * st->latency_ + ms) / 4 : ms;
+	     }
 	     idle_ = false;
 	  } else {
 	     Message(MSG_W,Msg::login_failed(host_));
-	     shutdown(0);
+	     shutdown(0);		// Kein erneuter Versuch
 	  }
-       } else if (iob_.tag_ == 'T' && sscanf(iob_.data_,"%x %c %x",&jid,&how,&code) == 3) {
-	  RemoteJob *j = find_job(jid);
-	  YABU_ASSERT(j != 0);
-	  if (j != 0)
+       } else if (iob_.tag_ == 'L') {
+	  // Freie Plätze des Servers, wir schicken höchstens so viele Skripte
+	  unsigned slots, load;
+	  if (sscanf(iob_.data_,"%u %u",&slots,&load) == 2) {
+	     limit_ = slots;
+	     load_ = load;
+	     idle_ = false;
+	  }
+       } else if (iob_.tag_ == 'T' && iob_.get_status(&jid,&how,&code)) {
+	  // Unbekannt ist nur ein verworfener Job, siehe «Script::discard()»
+	  if (RemoteJob *j = find_job(jid))
 	     do_next_chunk(j,how == 'E' && code == 0);
-       } else if (iob_.tag_ == 'O' && iob_.len_ > 8) {
-	  sscanf(iob_.data_,"%8x",&jid);
+       } else if (iob_.tag_ == 'O' && iob_.get_output(&jid,&out,&out_len)) {
 	  RemoteJob *j = find_job(jid);
-	  if (j && max_output_lines != 0)
-	     j->script_->obuf_.append(iob_.data_+8,iob_.len_-8);	// Ausgabe puffern
-	  else
-	      write(1,iob_.data_+8,iob_.len_-8);			// Sofort ausgeben
+	  if (j == 0)
+	     ;							// Verworfen
+	  else if (collect_output() || j->script_->speculative())
+	     j->script_->obuf_.append(out,out_len);		// Ausgabe puffern
+	  else {
+	     job_progress_clear();
+	     write(1,out,out_len);				// Sofort ausgeben
+	  }
        }
        else 
 	  printf("??? %c %s\n",iob_.tag_,iob_.data_);
     }
 
-    if ((events & (POLLHUP | POLLERR)) || rc <= 0) {
+    if ((events & (POLLHUP | POLLERR)) || rc == 0 || IoBuffer::failed(rc,err)) {
        shutdown(ECONNRESET);
        return 1;		// Bewirkt del_fd()
     }
@@ -1240,13 +2380,17 @@ int Server::handle_input(int fd, int events)
 // die Server-Warteschlangen und legen die Konfiguration für die lokale Warteschlange fest.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool job_add_host(const char *name, struct sockaddr_in const *sa,
-      int max_jobs, int prio, const char *cfg)
+bool job_add_host(const char *name, struct sockaddr_storage const *sa,
+      int max_jobs, int prio, const char *cfg, const char *unix_path)
 {
+   struct sockaddr_storage su;
+   if (sa && unix_path && !strcmp(name,my_hostname()) && sys_unix_addr(&su,unix_path))
+      sa = &su;					// Gleicher Rechner: Unix-Socket statt TCP
    if (sa && use_server) {				// Es ist ein Server
       Str s(cfg);
       s.append("-_local");
-      new Server(s,name,sa,max_jobs,prio);
+      if (!Server::reload(s,name,sa,max_jobs,prio))
+	 new Server(s,name,sa,max_jobs,prio);
       if (*auth_token == 0 && *yabu_cfg_dir != 0)	// Anmelde-Token erzeugen
 	 auth_token = make_auth_token(yabu_cfg_dir);
    }
@@ -1262,12 +2406,92 @@ bool job_add_host(const char *name, struct sockaddr_in const *sa,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Server-Liste neu einlesen (siehe «check_cfg_reload()»). Zwischen «job_reload_begin()» und
+// «job_reload_end()» liest der Aufrufer die Konfigurationsdateien neu, «job_add_host()» findet
+// dabei bekannte Server über «Server::reload()» wieder. Warteschlangen-Nummern bleiben gültig,
+// denn Server werden nie gelöscht, sondern nur als entfernt markiert. Mit «complete» = false fehlen
+// Server, deren Adresse noch aufgelöst wird. Dann entfernen wir keinen Server, sonst könnten
+// wartende Skripte ohne Server dastehen, bevor der Ersatz da ist.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool reloading = false;
+static size_t n_servers_before_reload = 0;
+
+void job_reload_begin()
+{
+   for (size_t i = 1; i < n_servers; ++i)
+      servers[i]->seen_ = false;
+   n_servers_before_reload = n_servers;
+   reloading = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sucht beim Neueinlesen einen bekannten Server mit gleichem Namen und gleicher Adresse und
+// übernimmt die neuen Werte. Return: false, wenn der Server neu ist.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Server::reload(const char *cfg, const char *host, struct sockaddr_storage const *addr,
+      unsigned max_jobs, unsigned prio)
+{
+   if (!reloading)
+      return false;
+   for (size_t i = 1; i < n_servers; ++i) {
+      Server *const s = servers[i];
+      if (   strcmp(s->host_,host) || s->addr_.ss_family != addr->ss_family
+	  || memcmp(&s->addr_,addr,sys_addr_len(addr)))
+	 continue;
+      s->seen_ = true;
+      s->stats_ = ServerStats::index(host);
+      s->cfg_ = str_freeze(cfg);
+      s->max_jobs_ = max_jobs;
+      s->prio_ = prio;
+      if (s->removed_) {			// Wieder aufgenommen
+	 s->removed_ = false;
+	 if (s->state_ == DEAD) {
+	    s->state_ = CREATED;
+	    s->retry_ms_ = 0;
+	 }
+	 MSG(MSG_0,Msg::servers_reloaded(host,true));
+      }
+      s->idle_ = false;
+      return true;
+   }
+   return false;
+}
+
+
+void job_reload_end(bool complete)
+{
+   reloading = false;
+   for (size_t i = 1; i < n_servers; ++i) {
+      Server *const s = servers[i];
+      if (i >= n_servers_before_reload)
+	 MSG(MSG_0,Msg::servers_reloaded(s->host_,true));
+      else if (complete && !s->seen_ && !s->removed_) {
+	 s->removed_ = true;
+	 MSG(MSG_0,Msg::servers_reloaded(s->host_,false));
+      }
+   }
+
+   // Kompatibilität neu berechnen und die wartenden Skripte neu einsortieren
+   while (CompatEntry *ce = compat_head) {
+      compat_head = ce->next_;
+      delete ce;
+   }
+   Script::reselect_all();
+   idle = false;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Globale Initialisierung
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void job_init()
 {
+   PollObj::watch_children();
    job_export_env("USER");
    job_export_env("LOGNAME");
    job_export_env("TERM");
@@ -1278,6 +2502,17 @@ void job_init()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Schließt Ziele von der spekulativen Ausführung aus (!nospeculate).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void job_no_speculate(StringList const &tgts)
+{
+   for (size_t i = 0; i < tgts.size(); ++i)
+      no_speculate.append(tgts[i]);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Definiert eine (feste) Variable im Skript-Environment
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1285,6 +2520,7 @@ void job_init()
 void job_export(const char *name, const char *value)
 {
    static_env.set(name,value);
+   EnvSnapshot::changed();
 }
 
 
@@ -1307,8 +2543,10 @@ void job_export_var(const char *name)
 void job_export_env(const char *name)
 {
    char const *value = getenv(name);
-   if (value)
+   if (value) {
       static_env.set(name,value);
+      EnvSnapshot::changed();
+   }
 }
 
 
@@ -1340,76 +2578,301 @@ const char *job_local_cfg()
    return local_cfg;
 }
 
-// vim:sw=3 cin fileencoding=utf-8
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liefert den Eintrag für «host» in «server_stats» (legt ihn bei Bedarf an). Der Zeiger ist nur bis
+// zum nächsten Aufruf gültig.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ServerStats *ServerStats::get(const char *host)
+{
+   for (size_t i = 0; i < n_server_stats; ++i) {
+      if (!strcmp(server_stats[i].host_,host))
+	 return server_stats + i;
+   }
+   array_realloc(server_stats,n_server_stats + 1);
+   ServerStats *st = server_stats + n_server_stats++;
+   st->host_ = str_freeze(host);
+   st->speed_ = 0;
+   st->latency_ = 0;
+   return st;
+}
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Geschwindigkeit des Servers: erwartete Laufzeit relativ zur lokalen Ausführung (< 1: schneller).
+// Ohne Messwerte nehmen wir 1 an.
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-class TokenQueue: public PollObj
+double Server::speed() const
 {
-public:
-   static const unsigned MAX_SIZE;
-   TokenQueue(unsigned size);
-   bool get_token();
-   bool return_token();
-private:
-   int rfd_;
-   int wfd_;
-   unsigned n_;
-};
+   ServerStats const *st = stats();
+   return st->speed_ > 0 ? st->speed_ : 1.0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Erwartete Dauer eines durchschnittlichen Skripts auf diesem Server in ms, einschließlich der
+// Verbindungslatenz. Bei kurzen Skripten fällt die Latenz stärker ins Gewicht.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double Server::cost() const
+{
+   double const avg = Target::n_durations > 0
+      ? (double) Target::total_duration / Target::n_durations : 1000.0;
+   return avg * speed() + stats()->latency_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Skript für «t» wurde auf diesem Server in «ms» Millisekunden ausgeführt. Ist die (auf lokale
+// Ausführung umgerechnete) Laufzeit von «t» bekannt, geht das Verhältnis als gleitender Mittelwert
+// in die Geschwindigkeit ein. Anschließend speichern wir die umgerechnete Laufzeit.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Server::update_stats(Target *t, unsigned long ms)
+{
+   ServerStats *const st = stats();
+   if (t->duration_ > 0 && ms > 0) {
+      double const ratio = (double) ms / t->duration_;
+      st->speed_ = st->speed_ > 0 ? 0.75 * st->speed_ + 0.25 * ratio : ratio;
+   }
+   t->set_duration((unsigned) (ms / speed()));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Serverstatistik aus der Statusdatei lesen:  server <host> <speed*1000> <latency_ms>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void job_read_server_stats(const StringList &args)
+{
+   unsigned speed, latency;
+   if (   args.size() >= 4 && StateFileReader::decode(speed,args[2])
+       && StateFileReader::decode(latency,args[3])) {
+      ServerStats *st = ServerStats::get(args[1]);
+      st->speed_ = speed / 1000.0;
+      st->latency_ = latency;
+   }
+}
+
+
+void job_write_server_stats(StateFileWriter &sf)
+{
+   for (size_t i = 0; i < n_server_stats; ++i) {
+      ServerStats const &st = server_stats[i];
+      if (st.speed_ <= 0 && st.latency_ == 0)
+	 continue;
+      sf.begin("server");
+      sf.append(st.host_);
+      sf.append((unsigned) (st.speed_ * 1000 + 0.5));
+      sf.append(st.latency_);
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Konstruktor. «rfd» ist ein eigener (nicht-blockierender) Deskriptor zum Lesen der Tokens.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TokenQueue::TokenQueue(int rfd, int wfd, bool toggle, const char *makeflags)
+   :jobs_(0), wfd_(wfd), toggle_(toggle), held_(0), n_held_(0), max_held_(0),
+    makeflags_(str_freeze(makeflags)), own_(false), tokens_(0), limit_(0)
+{
+   add_fd(rfd);
+   clear_events(POLLIN);	// Nur bei Bedarf, siehe «get_token()»
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Öffnet den Lese-Deskriptor «fd» eines geerbten Jobservers erneut. Der neue Deskriptor hat eigene
+// Flags, so daß O_NONBLOCK die anderen Teilnehmer nicht stört. Liefert -1, falls das nicht geht.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int reopen_nonblocking(int fd)
+{
+#if defined(__linux__)
+   char path[40];
+   snprintf(path,sizeof(path),"/proc/self/fd/%d",fd);
+   int const nfd = open(path,O_RDONLY | O_NONBLOCK);
+   if (nfd >= 0)
+      set_close_on_exec(nfd);
+   return nfd;
+#else
+   return -1;
+#endif
+}
 
-const unsigned TokenQueue::MAX_SIZE = 1024;
 
-TokenQueue::TokenQueue(unsigned size)
-   :rfd_(-1), wfd_(-1), n_(0)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Jobserver aus MAKEFLAGS übernehmen oder (nur mit «jobserver_create») selbst einen erzeugen.
+// Erkannt werden die Formen "--jobserver-auth=R,W", "--jobserver-auth=fifo:PATH" und (ältere
+// make-Versionen) "--jobserver-fds=R,W". Liefert 0, wenn kein Jobserver benutzt wird.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TokenQueue *TokenQueue::create()
 {
-   static const char VAR_NAME[] = "YABU_JOB_CONTROL_PIPE";
-   if (const char *env = getenv(VAR_NAME)) {
-      int rfd, wfd;
-      if (sscanf(env,"%d,%d",&rfd,&wfd) == 2 ) {
-	 rfd_ = rfd;
-	 wfd_ = wfd;
+   if (!use_jobserver || no_exec)
+      return 0;
+
+   const char *flags = getenv("MAKEFLAGS");
+   const char *auth = 0;
+   for (const char *c = flags; c && (c = strstr(c,"--jobserver-")) != 0; ++c)
+      auth = c;					// Die letzte Angabe gilt
+   if (auth && (auth = strchr(auth,'=')) != 0) {
+      ++auth;
+      TokenQueue *tq = 0;
+      int rfd = -1, wfd = -1;
+      if (!strncmp(auth,"fifo:",5)) {
+	 auth += 5;
+	 Str path(auth,strcspn(auth," "));
+	 if ((rfd = open(path,O_RDWR | O_NONBLOCK)) >= 0) {
+	    set_close_on_exec(rfd);
+	    tq = new TokenQueue(rfd,rfd,false,flags);
+	 }
+      } else if (sscanf(auth,"%d,%d",&rfd,&wfd) == 2
+	    && rfd >= 0 && fcntl(rfd,F_GETFD) != -1 && fcntl(wfd,F_GETFD) != -1) {
+	 int fd = reopen_nonblocking(rfd);
+	 bool const toggle = fd < 0;
+	 if (toggle && (fd = dup(rfd)) >= 0)
+	    set_close_on_exec(fd);
+	 if (fd >= 0)
+	    tq = new TokenQueue(fd,wfd,toggle,flags);
+      }
+      if (tq == 0) {
+	 // make hat den Jobserver nicht an uns weitergegeben (Kommando ohne '+')
+	 Message(MSG_1,"MAKEFLAGS: jobserver unavailable");
+	 return 0;
+      }
+
+      // Parallelität von make übernehmen ("-jN")
+      for (const char *j = flags; (j = strstr(j,"-j")) != 0; ++j) {
+	 if ((j == flags || j[-1] == ' ') && IS_DIGIT(j[2]))
+	    tq->jobs_ = atoi(j + 2);
       }
+      return tq;
    }
 
+   // Eigener Jobserver, die Tokens legt «resize()» an. Vorhandene MAKEFLAGS bleiben erhalten.
+   unsigned const limit = local_jobs > 0 ? (unsigned) local_jobs : max_active;
    int pfd[2];
-   pipe(pfd);
-   rfd_ = pfd[0];
-   wfd_ = pfd[1];
-   if (size > MAX_SIZE) size = MAX_SIZE;
-   unsigned char dummy[MAX_SIZE];
-   memset(dummy,rfd_ & 0xFF,size);
-   write(wfd_,dummy,size);
-   static char env_var[50];
-   snprintf(env_var,sizeof(env_var),"%s=%d,%d",VAR_NAME,rfd_,wfd_);
-   putenv(env_var);
+   if (!own_jobserver || limit < 2 || pipe(pfd) != 0)
+      return 0;
+   int fd = reopen_nonblocking(pfd[0]);
+   bool toggle = false;
+   if (fd < 0) {
+      fd = dup(pfd[0]);
+      set_close_on_exec(fd);
+      toggle = true;
+   }
+   TokenQueue *const tq = new TokenQueue(fd,pfd[1],toggle,"");
+   tq->own_ = true;
+   if (flags && *flags)
+      tq->flags_.printf("%s ",flags);
+   tq->auth_.printf(" --jobserver-auth=%d,%d",pfd[0],pfd[1]);
+   tq->resize(limit);
+   return tq;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liefert den Jobserver (wird beim ersten Aufruf erzeugt) oder 0.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TokenQueue *TokenQueue::get()
+{
+   static bool initialized = false;
+   static TokenQueue *tq = 0;
+   if (!initialized) {
+      initialized = true;
+      tq = create();
+   }
+   return tq;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Versucht, ein Token zu lesen, ohne zu blockieren. Falls keines verfügbar ist, überwachen wir den
+// Deskriptor, damit «poll()» uns weckt, sobald ein anderer Teilnehmer ein Token zurückgibt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TokenQueue::read_token(char *c)
+{
+   int const fd = this->fd();
+   long const flags = toggle_ ? fcntl(fd,F_GETFL) : 0;
+   if (toggle_)
+      fcntl(fd,F_SETFL,flags | O_NONBLOCK);
+   int const rc = yabu_read(fd,c,1);
+   if (toggle_)
+      fcntl(fd,F_SETFL,flags);
+   return rc == 1;
+}
+
 bool TokenQueue::get_token()
 {
-   unsigned char dummy;
-   int rc = read(rfd_,&dummy,1);
-   if (rc != 1 || dummy != (rfd_ & 0xFF))
+   char c;
+   if (!read_token(&c)) {
+      set_events(POLLIN);
       return false;
-   ++n_;
+   }
+   if (n_held_ >= max_held_)
+      array_realloc(held_,max_held_ += 16);
+   held_[n_held_++] = c;
    return true;
 }
 
-bool TokenQueue::return_token()
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gibt ein Token an den Jobserver zurück.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TokenQueue::return_token()
 {
-   if (n_ == 0)
-      return false;
-   unsigned char const dummy = rfd_ & 0xFF;
-   int rc;
-   do {
-       rc = write(rfd_,&dummy,1);
-   } while (rc == -1 && errno == EINTR);
-   if (rc != 1)
-      return false;
-   --n_;
-   return true;
+   YABU_ASSERT(n_held_ > 0);
+   if (n_held_ > 0) {
+      yabu_write(wfd_,&held_[--n_held_],1);
+      idle = false;
+   }
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Paßt die Anzahl der Tokens im eigenen Jobserver an «limit» an (geänderte «local_jobs» oder
+// «adapt_limit()»). Überzählige Tokens nehmen wir aus der Pipe, sobald sie zurückgegeben werden;
+// bis dahin laufen Unter-Builds evtl. noch mit dem alten Budget. Das -jN in MAKEFLAGS folgt
+// sofort, es gilt aber nur für danach gestartete Skripte.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TokenQueue::resize(unsigned limit)
+{
+   if (!own_)
+      return;
+   if (limit != limit_) {
+      Str mf(flags_);
+      mf.printf("-j%u",limit);
+      mf.append(auth_);
+      makeflags_ = str_freeze(mf);
+      limit_ = limit;
+   }
+   unsigned const want = limit > 1 ? limit - 1 : 0;
+   for (; tokens_ < want; ++tokens_)
+      yabu_write(wfd_,"+",1);
+   char c;
+   while (tokens_ > want && read_token(&c))
+      --tokens_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ein Token ist verfügbar geworden.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TokenQueue::handle_input(int fd, int events)
+{
+   clear_events(POLLIN);
+   idle = false;
+   return 0;
+}
+
 // vim:sw=3 cin fileencoding=utf-8
 
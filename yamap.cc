@@ -165,6 +165,18 @@ bool StringMap::contains(const char *key) const
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prüft ob ein Eintrag «key_val» (KEY=VALUE) mit genau diesem Wert vorhanden ist.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool StringMap::contains_entry(const char *key_val) const
+{
+   const char *equ = strchr(key_val,'=');
+   size_t pos;
+   return equ != 0 && bs(&pos,buf_,n_,key_val,equ - key_val) && strcmp(buf_[pos],key_val) == 0;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Eintrag hinzufügen bzw. Wert ändern.
 // return: True: neuer Wert wurde eingefügt. False: vorhandener Wert wurde überschrieben.
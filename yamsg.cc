@@ -129,6 +129,7 @@ void HighlightSetting::get(const char **beg, const char **end, unsigned flags)
 
 void std_message_handler(unsigned flags, const char *txt)
 {
+   job_progress_clear();
    fputs(txt,stdout);
 }
 
@@ -933,7 +934,7 @@ const char *Msg::already_built(const char *name)
 const char *Msg::usage()
 {
    M(  ("Syntax: yabu [-c <Cfg>] [-f <File>] [-g <CfgDir>] [-y <Algo>] \\\n"
-        "             [-S <Shell>] [-D <Dump>] [-aAceEjJkKmMnpPqrRsSvVy] [<Target>]...\n"
+        "             [-S <Shell>] [-D <Dump>] [-l <N>] [-aAceEjJkKmMnpPqrRsSvVy] [<Target>]...\n"
         "\n"
         "    -a/A   Execute/don't execute auto dependency scripts\n"
         "    -c     Use specified configuration\n"
@@ -944,6 +945,7 @@ const char *Msg::usage()
         "    -g     Global configuration directory\n"
         "    -j/J   Don't use/use Yabu server(s)\n"
         "    -k/K   Abort/continue on non-fatal error\n"
+        "    -l     Run up to <N> local jobs at once (N or 'auto', default: $YABU_JOBS)\n"
         "    -m/M   Create/don't create missing directories\n"
         "    -n     Dry run, don't execute commands. Implies -e\n"
         "    -p/P   Execute commands sequentially/concurrently\n"
@@ -958,7 +960,7 @@ const char *Msg::usage()
         "              mtid ...... use mt, but treat like checksum\n"
         "              cksum ..... CRC checksum of file contents\n"),
    M_(de,("Syntax: yabu [-c <Cfg>] [-f <File>] [-g <CfgDir>] [-y <Algo>] \\\n"
-        "             [-S <Shell>] [-D <Auswahl>] [-aAceEjJkKmMnpPqrRsSvVy] [<Ziel>]...\n"
+        "             [-S <Shell>] [-D <Auswahl>] [-l <N>] [-aAceEjJkKmMnpPqrRsSvVy] [<Ziel>]...\n"
         "\n"
         "    -a/A   Autodepend-Skripte nicht ausführen/ausführen\n"
         "    -c     Benutze die Konfiguration <Cfg>\n"
@@ -969,6 +971,7 @@ const char *Msg::usage()
         "    -g     Globales Konfigurationsverzeichnis\n"
         "    -j/J   Yabu-Server nicht verwenden/verwenden\n"
         "    -k/K   Bei Fehler abbrechen/weitermachen\n"
+        "    -l     Bis zu <N> lokale Jobs gleichzeitig (N oder 'auto', Default: $YABU_JOBS)\n"
         "    -m/M   Wenn Verzeichnis fehlt: erstellen/abbrechen\n"
         "    -n     Probelauf, Kommandos nicht ausführen (impliziert -e)\n"
         "    -q     Weniger Meldungen ausgeben\n"
@@ -983,7 +986,7 @@ const char *Msg::usage()
         "              mtid ...... Änderungszeit wie Prüfsumme behandeln \n"
         "              cksum ..... Prüfsumme (CRC)\n"))
    M_(fr,("Syntaxe: yabu [-c <Cfg>] [-f <Fichier>] [-g <CfgDir>] [-y <Algo>] \\\n"
-        "             [-S <Shell>] [-aAceEjJkKmMnpPqrRsSvVy] [<Cible>]...\n"
+        "             [-S <Shell>] [-l <N>] [-aAceEjJkKmMnpPqrRsSvVy] [<Cible>]...\n"
         "\n"
         "    -a/A   Exécuter/ne pas exécuter les scripts «[auto-depend]»\n"
         "    -c     Utiliser configuration specifiée\n"
@@ -994,6 +997,7 @@ const char *Msg::usage()
         "    -j/J   Ne pas utiliser/utiliser serveur(s) Yabu\n"
         "    -f     Lire <Fichier> à la place de Buildfile\n"
         "    -k/K   En cas d'erreur: avorter/continuer\n"
+        "    -l     Exécuter jusqu'à <N> commandes locales à la fois (N ou «auto»)\n"
         "    -m/M   Créer/ne pas créer répertoires parents manquants\n"
         "    -n     N'exécuter aucune des commandes, seulement les afficher\n"
         "    -p/P   Exécuter les commandes une à une/simultanément\n"
@@ -1009,7 +1013,7 @@ const char *Msg::usage()
         "              cksum ..... somme de contrôle CRC\n"))
 
    M_(es,("Sintaxis: yabu [-c <Cfg>] [-f <File>] [-g <CfgDir>] [-y <Algo>] \\\n"
-        "             [-S <Shell>] [-D <Dump>] [-aAceEjJkKmMnpPqrRsSvVy] [<Target>]...\n"
+        "             [-S <Shell>] [-D <Dump>] [-l <N>] [-aAceEjJkKmMnpPqrRsSvVy] [<Target>]...\n"
         "\n"
         "    -a/A   Ejecutar/no ejecutar los guiónes «[auto-depend]»\n"
         "    -c     Utilizar la configuración especificada\n"
@@ -1020,6 +1024,7 @@ const char *Msg::usage()
         "    -g     Directorio global de configuración\n"
         "    -j/J   No utilizar/utilizar yabusrv\n"
         "    -k/K   En el caso de error: cancelar/seguir\n"
+        "    -l     Ejecutar hasta <N> pedidos locales juntos (N o 'auto')\n"
         "    -m/M   Cuando un directorio falta: crear/no crear\n"
         "    -n     No ejecutar el pedido, solamente mostrar\n"
         "    -p/P   Ejecutar los pedidos uno por uno/juntos\n"        
@@ -1256,6 +1261,49 @@ const char *Msg::userinit_failed(const char *name, const char *f, int arg, int e
    )
 }
 
+const char *Msg::local_jobs(unsigned n)
+{
+   M(    ("Running up to %u local job%s",n,n == 1 ? "" : "s"),
+   M_(de,("Bis zu %u lokale Job%s gleichzeitig",n,n == 1 ? "" : "s"))
+   M_(fr,("Jusqu'à %u commande(s) locale(s) simultanée(s)",n))
+   )
+}
+
+
+const char *Msg::progress(unsigned done, unsigned total, unsigned running, unsigned waiting,
+      const char *eta)
+{
+   M(    ("[%u/%u] %u running, %u waiting, ETA %s",done,total,running,waiting,eta),
+   M_(de,("[%u/%u] %u laufen, %u warten, Restzeit %s",done,total,running,waiting,eta))
+   M_(fr,("[%u/%u] %u en cours, %u en attente, temps restant %s",done,total,running,waiting,eta))
+   )
+}
+
+
+const char *Msg::script_requeued(const char *target, const char *host, unsigned n, unsigned max)
+{
+   M(    ("Restarting %s (lost connection to %s, attempt %u of %u)",target,host,n,max),
+   M_(de,("Starte %s neu (Verbindung zu %s verloren, Versuch %u von %u)",target,host,n,max))
+   M_(fr,("Relance de %s (connexion perdue avec %s, essai %u sur %u)",target,host,n,max))
+   )
+}
+
+
+const char *Msg::servers_reloaded(const char *host, bool added)
+{
+   if (added) {
+      M(    ("Server %s added",host),
+      M_(de,("Server %s hinzugefügt",host))
+      M_(fr,("Serveur %s ajouté",host))
+      )
+   }
+   M(    ("Server %s removed, finishing running scripts",host),
+   M_(de,("Server %s entfernt, laufende Skripte werden beendet",host))
+   M_(fr,("Serveur %s retiré, les scripts en cours se terminent",host))
+   )
+}
+
+
 const char *Msg::waiting_for_jobs(unsigned n)
 {
    M(    ("Still waiting for %u jobs to finish",n),
@@ -11,6 +11,14 @@
 #include <errno.h>
 #include <poll.h>
 
+// Unter Linux benutzen wir epoll: Die Kosten pro Aufruf von «poll()» hängen dann nur von der
+// Anzahl der bereiten Dateien ab und nicht von der Gesamtzahl.
+#if defined(__linux__)
+#include <stdint.h>
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+
 
 static unsigned last_id = 0;		// Fortlaufende Numerierung der Objekte
 static size_t n_poll = 0;		// Anzahl Dateien
@@ -18,6 +26,30 @@ static size_t max_poll = 0;		// Größe der Puffer «pollfd» und «pollobj»
 static struct pollfd *pollfd = 0;	// Aktive Dateien
 static PollObj **pollobj = 0;		// Zugehörige Objekte
 
+#ifdef USE_EPOLL
+static int epfd = -1;			// epoll-Instanz
+static size_t n_open = 0;		// Anzahl offener Dateien
+static size_t n_free = 0;		// Anzahl freier Einträge in «free_idx»
+static size_t *free_idx = 0;		// Freie Einträge in «pollfd[]»
+static unsigned *pollgen = 0;		// Generation je Eintrag, siehe «dispatch()»
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Überträgt die Ereignismaske eines Eintrags in die epoll-Instanz.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ep_ctl(int op, size_t idx)
+{
+   struct epoll_event ev;
+   memset(&ev,0,sizeof(ev));
+   if (pollfd[idx].events & POLLIN) ev.events |= EPOLLIN;
+   if (pollfd[idx].events & POLLOUT) ev.events |= EPOLLOUT;
+   ev.data.u64 = ((uint64_t) pollgen[idx] << 32) | idx;
+   if (epoll_ctl(epfd,op,pollfd[idx].fd,&ev) < 0 && op != EPOLL_CTL_DEL)
+      YUFTL(G20,syscall_failed("epoll_ctl",0));
+}
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Fügt einen Deskriptor in die Liste «pollfd[]» ein und setzt gleichzeitig in
@@ -28,17 +60,33 @@ void PollObj::add_fd(int fd)
 {
     YABU_ASSERT(fd >= 0);				// Ungültiger Deskriptor
     YABU_ASSERT(idx_ < 0 || pollfd[idx_].fd < 0);	// Mehrfaches add_fd()
+#ifdef USE_EPOLL
+    if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+       YUFTL(G20,syscall_failed("epoll_create1",0));
+    if (idx_ < 0 && n_free > 0)				// Freien Eintrag wiederverwenden
+       idx_ = free_idx[--n_free];
+#endif
     if (idx_ < 0) {
        if (n_poll >= max_poll) {			// Puffer bei Bedarf vergrößern
 	  max_poll += 10;
 	  array_realloc(pollfd,max_poll);
 	  array_realloc(pollobj,max_poll);
+#ifdef USE_EPOLL
+	  array_realloc(free_idx,max_poll);
+	  array_realloc(pollgen,max_poll);
+	  for (size_t i = n_poll; i < max_poll; ++i)
+	     pollgen[i] = 0;
+#endif
        }
        idx_ = n_poll++;
     }
     pollfd[idx_].fd = fd;
     pollfd[idx_].events = POLLIN;
     pollobj[idx_] = this;
+#ifdef USE_EPOLL
+    ++n_open;
+    ep_ctl(EPOLL_CTL_ADD,idx_);
+#endif
 }
 
 
@@ -50,6 +98,14 @@ void PollObj::del_fd()
 {
    if (idx_ >= 0) {
       YABU_ASSERT((size_t) idx_ < n_poll);
+#ifdef USE_EPOLL
+      // Explizit abmelden: Der Deskriptor kann in Kindprozessen weiterleben, dann würde
+      // «close()» allein ihn nicht aus der epoll-Instanz entfernen.
+      ep_ctl(EPOLL_CTL_DEL,idx_);
+      ++pollgen[idx_];
+      free_idx[n_free++] = idx_;
+      --n_open;
+#endif
       close(pollfd[idx_].fd);
       pollfd[idx_].fd = -1;
       pollobj[idx_] = 0;
@@ -58,6 +114,7 @@ void PollObj::del_fd()
 }
 
 
+#ifndef USE_EPOLL
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Unbenutzte Einträge in «pollfd[]» und «pollobj[]» entfernen.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -78,6 +135,7 @@ static void purge()
    }
    n_poll = k;
 }
+#endif
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,6 +158,31 @@ PollObj::~PollObj()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ruft die Callbacks für den Eintrag «i» auf. Ein Callback kann das Objekt löschen und (mit epoll)
+// kann der Eintrag sofort für eine andere Datei wiederverwendet werden. Das erkennen wir an der
+// geänderten Generation.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void dispatch(size_t i, int revents)
+{
+#ifdef USE_EPOLL
+   unsigned const gen = pollgen[i];
+#define VALID (pollobj[i] != 0 && pollgen[i] == gen)
+#else
+#define VALID (pollobj[i] != 0)
+#endif
+   int result = (revents & (POLLIN | POLLOUT)) == 0 && (revents & (POLLHUP | POLLERR)) != 0;
+   if (revents & POLLIN)
+      result |= pollobj[i]->handle_input(pollfd[i].fd,revents);
+   if ((revents & POLLOUT) && VALID)
+      result |= pollobj[i]->handle_output(pollfd[i].fd,revents);
+   if (result != 0 && VALID)
+      pollobj[i]->del_fd();
+#undef VALID
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Warte auf Datei-I/O.
 // Return: false, wenn keine Dateien offen sind, sonst immer true
@@ -107,8 +190,25 @@ PollObj::~PollObj()
 
 bool PollObj::poll(int timeout)
 {
+#ifdef USE_EPOLL
+   if (n_open == 0) return false;
+   struct epoll_event ev[32];
+   int rc = epoll_wait(epfd,ev,sizeof(ev) / sizeof(ev[0]),timeout);
+   if (rc < 0 && errno != EINTR)
+      YUFTL(G20,syscall_failed("epoll_wait",0));
+   for (int k = 0; k < rc; ++k) {
+      size_t const i = ev[k].data.u64 & 0xFFFFFFFF;
+      if (pollobj[i] == 0 || pollgen[i] != (unsigned) (ev[k].data.u64 >> 32))
+	 continue;		// Inzwischen geschlossen
+      int revents = 0;
+      if (ev[k].events & EPOLLIN) revents |= POLLIN;
+      if (ev[k].events & EPOLLOUT) revents |= POLLOUT;
+      if (ev[k].events & EPOLLHUP) revents |= POLLHUP;
+      if (ev[k].events & EPOLLERR) revents |= POLLERR;
+      dispatch(i,revents);
+   }
+#else
    purge();
-   //if (exit_code > 1 || n_poll == 0) return false;
    if (n_poll == 0) return false;
    int rc =::poll(pollfd, n_poll, timeout);
    if (rc < 0 && errno != EINTR)
@@ -118,16 +218,11 @@ bool PollObj::poll(int timeout)
       // aufruft. Für die neuen hinzugekommenen Dateien ist «revents» aber noch ungültig.
       size_t const n = n_poll;
       for (size_t i = 0; i < n; ++i) {
-	 int result = (pollfd[i].revents & (POLLIN | POLLOUT)) == 0
-	           && (pollfd[i].revents & (POLLHUP | POLLERR)) != 0;
-	 if (pollfd[i].revents & POLLIN)
-	    result |= pollobj[i]->handle_input(pollfd[i].fd,pollfd[i].revents);
-	 if ((pollfd[i].revents & POLLOUT) && pollfd[i].fd >= 0)
-	    result |= pollobj[i]->handle_output(pollfd[i].fd,pollfd[i].revents);
-	 if (result != 0 && pollobj[i])
-	    pollobj[i]->del_fd();
+	 if (pollfd[i].revents != 0 && pollobj[i] != 0)
+	    dispatch(i,pollfd[i].revents);
       }
    }
+#endif
    return true;
 }
 
@@ -135,13 +230,27 @@ bool PollObj::poll(int timeout)
 
 void PollObj::clear_events(int events)
 {
+    int const old = pollfd[idx_].events;
     pollfd[idx_].events &= ~events;
+#ifdef USE_EPOLL
+    if (pollfd[idx_].events != old)
+       ep_ctl(EPOLL_CTL_MOD,idx_);
+#else
+    (void) old;
+#endif
 }
 
 
 void PollObj::set_events(int events)
 {
+    int const old = pollfd[idx_].events;
     pollfd[idx_].events |= events;
+#ifdef USE_EPOLL
+    if (pollfd[idx_].events != old)
+       ep_ctl(EPOLL_CTL_MOD,idx_);
+#else
+    (void) old;
+#endif
 }
 
 int PollObj::fd() const
@@ -150,5 +259,42 @@ int PollObj::fd() const
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Beendete Kindprozesse über einen Deskriptor melden (signalfd). Damit weckt SIGCHLD «poll()»
+// zuverlässig auf, auch wenn das Signal kurz vor dem Aufruf eintrifft.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ChildWatch: public PollObj {
+   int handle_input(int fd, int events);
+};
+
+int ChildWatch::handle_input(int fd, int events)
+{
+   char buf[1024];
+   while (yabu_read(fd,buf,sizeof(buf)) > 0)
+      ;
+   got_sigchld = true;
+   return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aktiviert die Überwachung der Kindprozesse über «poll()», soweit das System es erlaubt. Andernfalls
+// bleibt es beim Signal-Handler, und «got_sigchld» wird wie bisher asynchron gesetzt.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PollObj::watch_children()
+{
+   static ChildWatch *watch = 0;
+   if (watch == 0) {
+      int const fd = sys_sigchld_fd();
+      if (fd >= 0) {
+	 watch = new ChildWatch;
+	 watch->add_fd(fd);
+      }
+   }
+}
+
+
 
 // vim:sw=3:cin:fileencoding=utf-8
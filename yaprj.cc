@@ -1051,6 +1051,16 @@ bool Project::state_file_read(const StringList &args)
 	    StateFileReader::decode(d->last_src_time_,args[i+1]);
 	 }
       }
+   } else if (!strcmp(args[0],"time")) {
+      // time <target> <ms>
+      unsigned ms;
+      if (args.size() >= 3) {
+	 StateFileReader::decode(ms,args[2]);
+	 if (ms > 0)
+	    get_tgt(args[1],true)->set_duration(ms);
+      }
+   } else if (!strcmp(args[0],"server")) {
+      job_read_server_stats(args);
    } else if (!strcmp(args[0],"default_targets")) {
       // nicht mehr benutzt
    } else if (!strcmp(args[0],"tsa")) {
@@ -1090,8 +1100,16 @@ void Project::state_file_write()
       StateFileWriter sf(state_file_);
       sf.begin("tsa");
       sf.append((unsigned)ts_algo_);
+      if (parent_ == 0)
+	 job_write_server_stats(sf);
       for (unsigned i = 0; i < n_tgts_; ++i) {
 	 Target *t = all_tgts_[i];
+	 if (t->duration_ > 0) {
+	    // time <target> <ms>
+	    sf.begin("time");
+	    sf.append(t->name_);
+	    sf.append(t->duration_);
+	 }
 	 if (t->is_alias_) continue;
 	 if (t->is_leaf()) continue;
 	 
@@ -26,6 +26,7 @@
 #include <syslog.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -45,7 +46,8 @@ struct SrvJob: public PollObj {
    const char *pre_exec();
    bool exec();
    int handle_input(int fd, int events);
-   void handle_exit(pid_t pid, int status);
+   bool handle_exit(pid_t pid, int status);
+   void cancel();
    static SrvJob *find_pid(pid_t pid);
    Client &client_;
    unsigned const cjid_;	// Job-Id des Clients
@@ -54,41 +56,89 @@ struct SrvJob: public PollObj {
    StringMap env_;		// Environment
    Str wd_;			// Arbeitsverzeichnis
    Str cmd_;			// Das Skript
+   Str batch_;			// Weitere Blöcke ('B'), jeweils mit NUL abgeschlossen
+   size_t bp_;			// Nächster Block in «batch_»
 private:
-   static SrvJob *pid_hash_tab[19];
+   static SrvJob **pid_hash_tab;
+   static size_t pid_hash_size;	// Zweierpotenz, wächst mit der Anzahl laufender Skripte
+   static size_t n_pids;
    pid_t pid_;
    SrvJob *next_pid_;
    SrvJob **prevp_pid_;
    void set_pid(pid_t pid);
    void del_pid();
    static size_t pid_hash(pid_t pid);
+   static void grow_pid_hash();
+};
+
+
+// Environment-Kopie eines Clients ('S'), siehe «Server::send_env()» in yajob.cc
+
+struct EnvSnap {
+   EnvSnap(unsigned id, EnvSnap *next) :id_(id), env_(static_env), next_(next) {}
+   unsigned const id_;
+   StringMap env_;
+   EnvSnap *next_;
+};
+
+
+// Einstellungen und Zähler eines Benutzers (alle seine Clients zusammen), siehe «start_jobs()».
+// Die Objekte bleiben bis zum Programmende bestehen.
+
+struct User {
+   User(const char *name, UserCfg const &cfg)
+      :name_(name), cfg_(cfg), n_jobs_(0), n_active_(0), next_(0) {}
+   static User *get(const char *name);
+   Str const name_;
+   UserCfg cfg_;
+   unsigned n_jobs_;	// Wartende und laufende Skripte aller Clients des Benutzers
+   unsigned n_active_;	// Laufende Skripte
+   User *next_;
 };
 
 
 // Verbindung zu einen yabu-Prozeß.
 
 struct Client: public PollObj {
-   Client(int fd, struct sockaddr_in const &sa);
+   Client(int fd, struct sockaddr_storage const &sa);
    ~Client();
    static void purge();
    int handle_input(int fd, int events);
    int handle_output(int fd, int events);
    bool handle_cmd(char tag, size_t len, char *cmd);
    bool handle_uid(char *cmd);
-   bool create_job(char *cmd);
+   void load_groups();
+   bool create_job(char *cmd, size_t len = 0);
+   bool cancel_job(unsigned jid);
+   bool define_env(unsigned id, char const *data, size_t len);
+   bool use_env(unsigned id);
    static void start_jobs();
+   static void advertise_all();
    bool start_job();
+   void job_done();
+   bool runs_before(Client const *other) const;
+   int job_nice() const;
    Client *next_;	// Liste aller Clients (Ringverkettung!)
    Client *prev_;
    IoBuffer iob_;
    SrvJob *w_head_;	// Wartende Jobs
    SrvJob **w_tail_;
    StringMap env_;
+   EnvSnap *snaps_;	// Environment-Kopien ('S')
    Str wd_;
    unsigned cjid_;
+   unsigned n_jobs_;	// Wartende und laufende Skripte
+   unsigned n_active_;	// Laufende Skripte
+   unsigned build_size_;	// Vom Client gemeldete Größe des Builds ('N'), 0 = unbekannt
+   unsigned adv_slots_;	// Zuletzt gemeldete Werte ('L'), siehe «advertise_all()»
+   unsigned adv_load_;
    int uid_;
+   int peer_uid_;	// Bei Unix-Sockets: Benutzer laut SO_PEERCRED, sonst -1
    Str uname_;
    int gid_;
+   gid_t *groups_;	// Zusätzliche Gruppen, einmal je Anmeldung ermittelt
+   int n_groups_;
+   User *user_;		// Gesetzt nach erfolgreicher Anmeldung
    DirMaker dirs_;
 };
 
@@ -103,27 +153,18 @@ struct TcpServer: public PollObj {
 
 static bool running_as_root = false;
 static unsigned total_active;
+static unsigned total_jobs = 0;		// Wartende und laufende Skripte aller Clients
 static unsigned max_active = 0;		// Max. Anzahl parallel ausgeführter Skripte
-static sockaddr_in my_addr;		// Unsere TCP-Adresse
+static sockaddr_storage my_addr;	// Unsere TCP-Adresse
+static Str my_unix_path;		// Unix-Socket für Clients auf dem gleichen Rechner
+static UserCfg default_user = { 1, 0, 5, 0, 5 };	// «*» im Abschnitt !users
+static User *users = 0;
 static SrvJob *r_head = 0;		// Laufende Jobs
 static SrvJob **r_tail = &r_head;
-SrvJob *SrvJob::pid_hash_tab[19];
-
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-// Dezimaldarstellung einer IPv4-Adresse
-////////////////////////////////////////////////////////////////////////////////////////////////////
-
-static const char *addr2str(struct sockaddr_in const &addr)
-{
-    static char buf[30];	// xxx.xxx.xxx.xxx:xxxxx 
-    unsigned a = ntohl(addr.sin_addr.s_addr);
-    snprintf(buf,sizeof(buf),"%u.%u.%u.%u:%u",
-        (a >> 24) & 0xff, (a>>16) & 0xff, (a>>8) & 0xff, a & 0xff,ntohs(addr.sin_port));
-    return buf;
-}
-
-
+static const size_t MAX_QUEUED = 1024 * 1024;	// Sendepuffer je Client, siehe «SrvJob::handle_input()»
+SrvJob **SrvJob::pid_hash_tab = 0;
+size_t SrvJob::pid_hash_size = 0;
+size_t SrvJob::n_pids = 0;
 
 
 // =================================================================================================
@@ -134,18 +175,24 @@ SrvJob::SrvJob(Client &cl, const char *cmd)
     : 
       client_(cl),  cjid_(cl.cjid_),
       next_(0), prevp_(0), env_(cl.env_),
-      wd_(cl.wd_), cmd_(cmd),
+      wd_(cl.wd_), cmd_(cmd), bp_(0),
       pid_(0), next_pid_(0), prevp_pid_(0)
 {
    Message(MSG_2,"[%u.%u] Init cjid=%u",client_.id_,id_,cjid_);
+   ++client_.n_jobs_;
+   ++client_.user_->n_jobs_;
+   ++total_jobs;
 }
 
 SrvJob::~SrvJob()
 {
+   --client_.n_jobs_;
+   --client_.user_->n_jobs_;
+   --total_jobs;
    YABU_ASSERT(prevp_ == 0);
    YABU_ASSERT(next_ == 0);
    if (pid_ > 1) {
-      kill(pid_,SIGKILL);
+      sys_kill_group(pid_,SIGKILL);
       del_pid();
    }
 }
@@ -178,17 +225,20 @@ SrvJob *SrvJob::remove(SrvJob ***tailp)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Ausgaben vom Skript lesen und in die Sende-Warteschlange stellen.
+// Ausgaben vom Skript lesen und in die Sende-Warteschlange stellen. Nimmt yabu die Daten nicht
+// schnell genug ab, lesen wir vorerst nicht weiter; das Skript blockiert dann beim Schreiben.
+// Weiter geht es in «Client::handle_output()».
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int SrvJob::handle_input(int fd, int events)
 {
    char tmp[8192];
-   snprintf(tmp,sizeof(tmp),"%08x",cjid_);
-   int n = read(fd,tmp + 8,sizeof(tmp) - 8);
+   int n = read(fd,tmp,sizeof(tmp));
    if (n <= 0)
       return 1;
-   client_.iob_.append('O',n + 8,tmp);
+   client_.iob_.append_output(cjid_,n,tmp);
+   if (client_.iob_.pending() > MAX_QUEUED)
+      clear_events(POLLIN);
    return 0;
 }
 
@@ -203,12 +253,11 @@ bool SrvJob::exec()
    pid_t pid;
 
    Message(MSG_2,"[%u.%u] Exec",client_.id_,id_);
-    if (!yabu_fork(&pfd,&pid,EXEC_COLLECT_OUTPUT | EXEC_MERGE_STDERR))
+    if (!yabu_fork(&pfd,&pid,EXEC_COLLECT_OUTPUT | EXEC_MERGE_STDERR | EXEC_NEW_PGRP))
        return false;
     if (pid == 0) {
         const char *err = pre_exec();
 	if (err == 0) {
-	   nice(5);
 	   execle(shell_prog,"sh","-c",(const char *)cmd_,(void *) 0,env_.env());
 	   static char tmp[200];
 	   snprintf(tmp,sizeof(tmp),"%s: errno=%d (%s)\n",
@@ -227,7 +276,32 @@ bool SrvJob::exec()
 
 size_t SrvJob::pid_hash(pid_t pid)
 {
-   return pid % sizeof(pid_hash_tab) / sizeof(pid_hash_tab[0]);
+   return (size_t) pid & (pid_hash_size - 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// PID-Hashtabelle verdoppeln, damit die Ketten auch bei vielen hundert Skripten kurz bleiben.
+// PIDs werden fortlaufend vergeben und verteilen sich daher gleichmäßig auf die Einträge.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SrvJob::grow_pid_hash()
+{
+   SrvJob **const old_tab = pid_hash_tab;
+   size_t const old_size = pid_hash_size;
+   pid_hash_size = old_size == 0 ? 64 : 2 * old_size;
+   array_alloc(pid_hash_tab,pid_hash_size);
+   for (size_t i = 0; i < old_size; ++i) {
+      SrvJob *next;
+      for (SrvJob *p = old_tab[i]; p != 0; p = next) {
+	 next = p->next_pid_;
+	 SrvJob **const head = pid_hash_tab + pid_hash(p->pid_);
+	 if ((p->next_pid_ = *head) != 0) p->next_pid_->prevp_pid_ = &p->next_pid_;
+	 p->prevp_pid_ = head;
+	 *head = p;
+      }
+   }
+   free(old_tab);
 }
 
 
@@ -241,6 +315,9 @@ void SrvJob::set_pid(pid_t pid)
    YABU_ASSERT(pid_ == 0);
    YABU_ASSERT(next_pid_ == 0);
    YABU_ASSERT(prevp_pid_ == 0);
+   if (n_pids >= pid_hash_size)
+      grow_pid_hash();
+   ++n_pids;
    pid_ = pid;
    size_t hp = pid_hash(pid);
    next_pid_ = pid_hash_tab[hp];
@@ -258,9 +335,12 @@ void SrvJob::del_pid()
 {
    YABU_ASSERT(pid_ > 1);
    YABU_ASSERT(prevp_pid_ != 0);
+   --n_pids;
    pid_ = 0;
    if ((*prevp_pid_ = next_pid_) != 0)
 	next_pid_->prevp_pid_ = prevp_pid_;
+   next_pid_ = 0;			// Für «set_pid()» mit dem nächsten Block
+   prevp_pid_ = 0;
 }
 
 
@@ -270,6 +350,8 @@ void SrvJob::del_pid()
 
 SrvJob *SrvJob::find_pid(pid_t pid)
 {
+   if (pid_hash_size == 0)
+      return 0;
    for (SrvJob *p = pid_hash_tab[pid_hash(pid)]; p != 0; p = p->next_pid_) {
       if (p->pid_ == pid)
 	 return p;
@@ -291,12 +373,18 @@ static Client *clients = 0;
 // Konstruktor
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Client::Client(int fd, struct sockaddr_in const &sa)
+Client::Client(int fd, struct sockaddr_storage const &sa)
     : iob_(*this), w_head_(0), w_tail_(&w_head_),
-      env_(static_env),
-      cjid_(0), uid_(-1), gid_(-1)
+      env_(static_env), snaps_(0),
+      cjid_(0), n_jobs_(0), n_active_(0), build_size_(0), adv_slots_(~0U), adv_load_(0), uid_(-1), peer_uid_(-1), gid_(-1), groups_(0), n_groups_(-1), user_(0)
 {
-   Message(MSG_1,"[%u] Client() %s fd=%d",id_,addr2str(sa),fd);
+   Message(MSG_1,"[%u] Client() %s fd=%d",id_,sys_addr2str(&sa),fd);
+#ifdef SO_PEERCRED
+   struct ucred cr;
+   socklen_t cr_len = sizeof(cr);
+   if (sa.ss_family == AF_UNIX && getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cr,&cr_len) == 0)
+      peer_uid_ = cr.uid;
+#endif
    if (clients == 0) {
       clients = this;
       next_ = this;
@@ -336,12 +424,18 @@ Client::~Client()
       SrvJob *n = j->next_;
       if (&j->client_ == this) {
 	 j->remove(&r_tail);
-	 --total_active;
+	 job_done();
 	 delete j;
       }
       j = n;
    }
 
+   while (EnvSnap *e = snaps_) {
+      snaps_ = e->next_;
+      delete e;
+   }
+   free(groups_);
+
    Message(MSG_2,"[%u] ~Client()",id_);
 }
 
@@ -373,8 +467,10 @@ void Client::purge()
 int Client::handle_input(int fd, int events)
 {
    int rc = iob_.read(fd);
-   if (rc <= 0)
+   if (rc == 0 || IoBuffer::failed(rc,errno))
       return -1;
+   if (rc < 0)
+      return 0;				// EAGAIN
    while (iob_.next())
       if (!handle_cmd(iob_.tag_,iob_.len_,iob_.data_))
 	 return -1;
@@ -383,12 +479,22 @@ int Client::handle_input(int fd, int events)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Daten an yabu senden
+// Daten an yabu senden. Ist der Puffer wieder klein genug, lesen wir weiter die Ausgaben der
+// Skripte, siehe «SrvJob::handle_input()».
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int Client::handle_output(int fd, int events)
 {
-   iob_.write(fd);
+   size_t const before = iob_.pending();
+   int const rc = iob_.write(fd);
+   if (IoBuffer::failed(rc,errno))
+      return -1;
+   if (before > MAX_QUEUED && iob_.pending() <= MAX_QUEUED) {
+      for (SrvJob *j = r_head; j; j = j->next_) {
+	 if (&j->client_ == this && j->idx_ >= 0)
+	    j->set_events(POLLIN);
+      }
+   }
    return 0;
 }
 
@@ -400,6 +506,7 @@ int Client::handle_output(int fd, int events)
 bool Client::handle_cmd(char tag, size_t len, char *cmd)
 {
     bool ok = true;
+    unsigned jid;
     switch (tag) {
 	case 'E':			// Environment
 	   Message(MSG_3,"[%u] E %s",id_,cmd);
@@ -413,7 +520,7 @@ bool Client::handle_cmd(char tag, size_t len, char *cmd)
 	   Message(MSG_2,"[%u] D %s",id_,cmd);
 	   break;
 	case 'I':			// Initialisierung, nächstes Skript
-	   ok = sscanf(cmd,"%x",&cjid_) == 1;
+	   ok = iob_.get_id(&cjid_);
 	   //env_.clear();
 	   break;
 	case 'M':			// Verzeichnis erzeugen
@@ -422,6 +529,30 @@ bool Client::handle_cmd(char tag, size_t len, char *cmd)
 	case 'C':			// Skript
 	   ok = create_job(cmd);
 	   break;
+	case 'B':			// Alle Blöcke eines Skripts
+	   ok = create_job(cmd,len);
+	   break;
+	case 'K':			// Skript abbrechen
+	   ok = iob_.get_id(&jid) && cancel_job(jid);
+	   break;
+	case 'S':			// Environment-Kopie anlegen
+	   {
+	      char const *data;
+	      size_t data_len;
+	      ok = iob_.get_id(&jid,&data,&data_len) && define_env(jid,data,data_len);
+	   }
+	   break;
+	case 'J':			// Environment-Kopie für das nächste Skript
+	   ok = iob_.get_id(&jid) && use_env(jid);
+	   break;
+	case 'N':			// Größe des Builds
+	   {
+	      Message(MSG_2,"[%u] N %s",id_,cmd);
+	      int n;
+	      if ((ok = next_int(&n,&cmd) && n >= 0))
+		 build_size_ = n;
+	   }
+	   break;
 	default:
 	    Message(MSG_0,"[%u] unknown command 0x%02x",id_,tag);
 	    ok = false;
@@ -441,44 +572,194 @@ bool Client::handle_uid(char *cmd)
    if (uid < MIN_UID) return false;
    char *token = str_chop(&cmd);
    if (token == 0 || *token == 0) return false;
-   struct passwd *pwd = auth_check(yabu_cfg_dir,uid,token);
+   int version;
+   unsigned proto = 0;
+   if (next_int(&version,&cmd) && version > 0)	// Fehlt bei älteren Clients
+      proto = (unsigned) version < PROTO_VERSION ? version : PROTO_VERSION;
+   static const char *fake_proto = getenv("YABU_FAKE_PROTO");	// Für Tests: älterer Server
+   if (fake_proto && (unsigned) atoi(fake_proto) < proto)
+      proto = atoi(fake_proto);
+   // Über einen Unix-Socket kennen wir den Benutzer bereits vom Kernel
+   struct passwd *pwd = peer_uid_ < 0 || peer_uid_ == uid ? auth_check(yabu_cfg_dir,uid,token) : 0;
    if (pwd != 0) {
       uid_ = uid;
       uname_ = pwd->pw_name;
       gid_ = pwd->pw_gid;
+      user_ = User::get(uname_);
+      load_groups();
    }
    Message(MSG_1,"[%u] %s",id_,Msg::login_result(uname_,pwd != 0));
-   iob_.append('U',pwd ? "+" : "-");
+   if (pwd != 0)
+      Message(MSG_1,"[%u] protocol %u",id_,proto);
+   if (pwd == 0)
+      iob_.append('U',"-");
+   else if (proto > 0) {
+      iob_.append('U',"+ %u",proto);
+      iob_.set_version(proto);		// Ab jetzt in beiden Richtungen
+   } else
+      iob_.append('U',"+");
    return true;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Ein Skript ausführen
+// Zusätzliche Gruppen des Benutzers ermitteln. Das geschieht einmal je Anmeldung statt mit
+// «initgroups()» in jedem Skript, denn die Abfrage geht oft über NSS an LDAP o.ä. Schlägt sie
+// fehl, bleibt «n_groups_» negativ und «pre_exec()» benutzt doch «initgroups()».
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool Client::create_job(char *cmd)
+void Client::load_groups()
+{
+   if (!running_as_root)
+      return;
+   int n = 32;
+   for (int tries = 0; tries < 3; ++tries) {
+      array_realloc(groups_,n);
+      int const want = n;
+      if (getgrouplist(uname_,gid_,groups_,&n) >= 0) {
+	 n_groups_ = n;
+	 return;
+      }
+      if (n <= want)			// Fehler, nicht nur zu wenig Platz
+	 break;
+   }
+   Message(MSG_W,Msg::userinit_failed(uname_,"getgrouplist",gid_,errno));
+   n_groups_ = -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Environment-Kopie «id» anlegen oder ersetzen. «data» enthält die Variablen (NAME=WERT), jeweils
+// mit NUL abgeschlossen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Client::define_env(unsigned id, char const *data, size_t len)
+{
+   Message(MSG_2,"[%u] S %x (%u bytes)",id_,id,(unsigned) len);
+   EnvSnap *const e = new EnvSnap(id,0);
+   for (char const *end = data + len; data < end; ) {
+      char const *nul = (char const *) memchr(data,0,end - data);
+      if (nul == 0) {
+	 delete e;
+	 return false;
+      }
+      e->env_.set(data);
+      data = nul + 1;
+   }
+   for (EnvSnap **pp = &snaps_; *pp; pp = &(*pp)->next_) {
+      if ((*pp)->id_ == id) {
+	 EnvSnap *const old = *pp;
+	 *pp = old->next_;
+	 delete old;
+	 break;
+      }
+   }
+   e->next_ = snaps_;
+   snaps_ = e;
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Environment für das nächste Skript auf die Kopie «id» zurücksetzen ('J'). Folgende 'E'-Sätze
+// ergänzen es.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Client::use_env(unsigned id)
+{
+   for (EnvSnap *e = snaps_; e; e = e->next_) {
+      if (e->id_ == id) {
+	 StringMap tmp(e->env_);
+	 env_.swap(tmp);
+	 return true;
+      }
+   }
+   Message(MSG_0,"[%u] unknown environment %x",id_,id);
+   return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ein Skript ausführen. Bei 'B' enthält «cmd» («len» Bytes) mehrere Blöcke, jeweils mit NUL
+// abgeschlossen. Sie laufen nacheinander auf demselben Platz, siehe «SrvJob::handle_exit()».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Client::create_job(char *cmd, size_t len)
 {
    if (uid_ < MIN_UID || cmd == 0)	// Nicht angemeldet
       return false;
    SrvJob *c = new SrvJob(*this,cmd);
+   size_t const first = strlen(cmd) + 1;
+   if (len > first)
+      c->batch_.append(cmd + first,len - first);
    c->append(&w_tail_);
    ++cjid_;				// Default für das nächste Kommando
    return true;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ein Skript abbrechen ('K'). Ein wartendes Skript wird gelöscht und sofort als beendet gemeldet,
+// ein laufendes mitsamt seiner Prozeßgruppe beendet. Das Ende meldet dann «handle_exit()». Ist
+// das Skript schon fertig, ignorieren wir das Kommando.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Client::cancel_job(unsigned jid)
+{
+   if (uid_ < MIN_UID)
+      return false;
+   Message(MSG_2,"[%u] K %x",id_,jid);
+   for (SrvJob *j = w_head_; j; j = j->next_) {
+      if (j->cjid_ == jid) {
+	 delete j->remove(&w_tail_);
+	 iob_.append_status(jid,'S',SIGKILL);
+	 return true;
+      }
+   }
+   for (SrvJob *j = r_head; j; j = j->next_) {
+      if (&j->client_ == this && j->cjid_ == jid) {
+	 j->cancel();
+	 break;
+      }
+   }
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Beendet das laufende Skript mitsamt seiner Prozeßgruppe. Das Ende meldet wie sonst auch
+// «handle_exit()», sobald SIGCHLD eintrifft; ein Prozeß, der z.B. auf NFS hängt, hält so nicht die
+// Hauptschleife für alle Clients an.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SrvJob::cancel()
+{
+   sys_kill_group(pid_,SIGKILL);
+   bp_ = batch_.len();			// Keine weiteren Blöcke
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Ausführung vorbereitung
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 const char *SrvJob::pre_exec()
 {
+   // Vor «setuid()», sonst scheitert ein negativer Wert («nice=», «smallnice=»)
+   int const n = client_.job_nice();
+   errno = 0;
+   if (n != 0 && nice(n) == -1 && errno != 0)
+      return Msg::userinit_failed(client_.uname_,"nice",n,errno);
+
    if (running_as_root) {
       // Gruppen- und Benutzer-Id setzen
       if (setgid(client_.gid_) < 0)
 	 return Msg::userinit_failed(client_.uname_,"setgid",client_.gid_,errno);
-      if (initgroups(client_.uname_,client_.gid_) < 0)
+      if (client_.n_groups_ >= 0) {
+	 if (setgroups(client_.n_groups_,client_.groups_) < 0)
+	    return Msg::userinit_failed(client_.uname_,"setgroups",client_.gid_,errno);
+      }
+      else if (initgroups(client_.uname_,client_.gid_) < 0)
 	 return Msg::userinit_failed(client_.uname_,"initgroups",client_.gid_,errno);
       if (setuid(client_.uid_) < 0)
 	 return Msg::userinit_failed(client_.uname_,"setuid",client_.uid_,errno);
@@ -493,10 +774,12 @@ const char *SrvJob::pre_exec()
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Prozeß beendet
+// Prozeß beendet. Jeder Block meldet seinen Status. War er erfolgreich und stehen weitere Blöcke
+// an ('B'), starten wir gleich den nächsten; das Objekt bleibt dann bestehen.
+// Return: true, wenn der nächste Block läuft, sonst false (Objekt kann gelöscht werden)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void SrvJob::handle_exit(pid_t pid, int status)
+bool SrvJob::handle_exit(pid_t pid, int status)
 {
    Message(MSG_2,"[%u.%u] Exit status=0x%x",client_.id_,id_,status);
 
@@ -505,13 +788,41 @@ void SrvJob::handle_exit(pid_t pid, int status)
 
    // Status zurückmelden
    if (WIFEXITED(status))
-      client_.iob_.append('T',"%x E %x",cjid_,WEXITSTATUS(status));
+      client_.iob_.append_status(cjid_,'E',WEXITSTATUS(status));
    else if (WIFSIGNALED(status))
-      client_.iob_.append('T',"%x S %x",cjid_,WTERMSIG(status));
+      client_.iob_.append_status(cjid_,'S',WTERMSIG(status));
    else 
-      client_.iob_.append('T',"%x ? %x",cjid_,status);
+      client_.iob_.append_status(cjid_,'?',status);
+
+   if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && bp_ < batch_.len()) {
+      del_fd();
+      del_pid();
+      cmd_ = (const char *) batch_ + bp_;
+      bp_ += strlen(cmd_) + 1;
+      if (exec())
+	 return true;
+      client_.iob_.append_status(cjid_,'E',123);	// Wie in «exec()»
+   }
    remove(&r_tail);
-   --total_active;
+   client_.job_done();
+   return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sucht die Einstellungen für Benutzer «name» oder legt sie mit den Vorgaben an
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+User *User::get(const char *name)
+{
+   for (User *u = users; u; u = u->next_) {
+      if (!strcmp(u->name_,name))
+	 return u;
+   }
+   User *const u = new User(name,default_user);
+   u->next_ = users;
+   users = u;
+   return u;
 }
 
 
@@ -528,6 +839,8 @@ bool Client::start_job()
    SrvJob *j = w_head_->remove(&w_tail_);
    j->append(&r_tail);
    ++total_active;
+   ++n_active_;
+   ++user_->n_active_;
 
    // Kindprozeß starten
    j->exec();
@@ -536,28 +849,114 @@ bool Client::start_job()
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Reihum von allen Benutzern neue Jobs starten, bis die maximale Anzahl erreicht ist oder keine
-// weiteren Jobs auführbereit sind.
+// Ein laufendes Skript dieses Clients ist beendet
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Client::job_done()
+{
+   --total_active;
+   --n_active_;
+   --user_->n_active_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reihenfolge für «start_jobs()»: Zuerst der Benutzer mit den wenigsten laufenden Skripten im
+// Verhältnis zu seinem Anteil («share=»), unter den Clients eines Benutzers der mit den wenigsten
+// laufenden Skripten.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Client::runs_before(Client const *other) const
+{
+   unsigned long const a = (unsigned long) user_->n_active_ * other->user_->cfg_.share_;
+   unsigned long const b = (unsigned long) other->user_->n_active_ * user_->cfg_.share_;
+   if (a != b)
+      return a < b;
+   return n_active_ < other->n_active_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// nice-Wert für das nächste Skript. Kleine Builds («small=») erhalten «smallnice=», damit sie auch
+// auf einem ausgelasteten Server schnell fertig werden. Die Größe meldet der Client ('N'); ohne
+// Meldung (ältere Clients, Auswahl läuft noch) gilt ein Build als groß.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Client::job_nice() const
+{
+   UserCfg const &uc = user_->cfg_;
+   bool const small = uc.small_ > 0 && build_size_ > 0 && build_size_ <= uc.small_;
+   return small ? uc.small_nice_ : uc.nice_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Freie Plätze an wartende Skripte vergeben (gewichtete faire Warteschlange). Jeder Platz geht an
+// den Client, der laut «runs_before()» am weitesten zurückliegt; Benutzer mit erreichtem «max=»
+// kommen nicht zum Zug. Ein Benutzer mit einem großen Build kann so den Server nicht für andere
+// blockieren, sobald Plätze frei werden. Bei Gleichstand geht es reihum weiter.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Client::start_jobs()
 {
+   while (total_active < max_active && clients != 0) {
+      Client *best = 0;
+      Client *cl = clients;
+      do {
+	 User const *const u = cl->user_;
+	 if (   cl->w_head_ && u != 0 && (u->cfg_.max_ == 0 || u->n_active_ < u->cfg_.max_)
+	     && (best == 0 || cl->runs_before(best)))
+	    best = cl;
+      } while ((cl = cl->next_) != clients);
+      if (best == 0)
+	 break;
+      best->start_job();
+      clients = best->next_;		// Startpunkt für den nächsten Gleichstand
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Freie Kapazität an die Clients melden ('L'). Jeder Client darf so viele Skripte schicken, wie er
+// schon bei uns hat, plus die noch freien Plätze; mehr landen ohnehin nur in der Warteschlange,
+// während andere Server vielleicht nichts zu tun haben. «max=» gilt je Benutzer, die Skripte
+// seiner anderen Clients zählen also mit. Wir melden nur Änderungen. Die Last
+// (Mittelwert über eine Minute, mal 100) lesen wir höchstens einmal je Sekunde.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Client::advertise_all()
+{
+   static unsigned load = 0;
+   static time_t last = 0;
+   time_t const now = time(0);
+   if (now != last) {
+      last = now;
+      SysLoad sl;
+      sys_get_load(&sl);
+      load = sl.load1 > 0 ? (unsigned) (sl.load1 * 100) : 0;
+   }
+
    if (clients == 0) return;
+   unsigned const free = total_jobs < max_active ? max_active - total_jobs : 0;
    Client *cl = clients;
-   bool loop = false;
-   while (total_active < max_active) {
-      if (cl->w_head_) {
-	 cl->start_job();
-	 if (cl->w_head_) loop = true;		// evtl. weiterer Durchlauf
-      }
-      if ((cl = cl->next_) == clients) {	// eine Runde ist komplett
-	 if (!loop) break;
-	 loop = false;
+   do {
+      if (cl->uid_ >= MIN_UID && cl->iob_.version() >= PROTO_CAPACITY) {
+	 User const *const u = cl->user_;
+	 unsigned slots = cl->n_jobs_ + free;
+	 if (u->cfg_.max_ > 0) {
+	    unsigned const others = u->n_jobs_ - cl->n_jobs_;
+	    unsigned const max = u->cfg_.max_ > others ? u->cfg_.max_ - others : 0;
+	    if (slots > max)
+	       slots = max;
+	 }
+	 if (   slots != cl->adv_slots_
+	     || load > cl->adv_load_ + 50 || load + 50 < cl->adv_load_) {
+	    cl->iob_.append('L',"%u %u",slots,load);
+	    cl->adv_slots_ = slots;
+	    cl->adv_load_ = load;
+	 }
       }
-   }
-
-   // Startpunkt für den nächsten Aufruf merken, damit alle Benutzer gleich behandelt werden.
-   clients = cl;
+   } while ((cl = cl->next_) != clients);
 }
 
 
@@ -580,11 +979,14 @@ TcpServer::~TcpServer()
 
 int TcpServer::handle_input(int fd, int events)
 {
-   struct sockaddr_in sa;
+   struct sockaddr_storage sa;
    socklen_t sa_len = sizeof(sa);
+   memset(&sa,0,sizeof(sa));
    int conn = accept(fd, (struct sockaddr *) &sa, &sa_len);
    if (conn >= 0) {
       set_close_on_exec(conn);
+      fcntl(conn,F_SETFL,fcntl(conn,F_GETFL) | O_NONBLOCK);
+      sys_tune_socket(conn,&sa);
       new Client(conn,sa);
    }
    return 0;
@@ -592,28 +994,60 @@ int TcpServer::handle_input(int fd, int events)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// TCP-Socket öffnen und auf Verbindungen warten.
+// Socket für «addr» öffnen und auf Verbindungen warten. Bei Unix-Sockets entfernen wir eine
+// übriggebliebene Socket-Datei; ein laufender Server hätte schon den TCP-Port belegt.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool TcpServer::init()
+static const int LISTEN_BACKLOG = 128;
+
+static bool listen_on(struct sockaddr_storage const &addr)
 {
-   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   int fd = socket(addr.ss_family, SOCK_STREAM, 0);
    if (fd < 0) {
       YUFTL(G20,syscall_failed("socket",0));
       return false;
    }
    int yes = 1;
    set_close_on_exec(fd);
-   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-   if (bind(fd, (struct sockaddr const *) &my_addr, sizeof(my_addr)) < 0) {
-      Message(MSG_W,Msg::addr_unusable(addr2str(my_addr),errno));
+   if (addr.ss_family == AF_UNIX) {
+      struct stat sb;
+      const char *const path = ((struct sockaddr_un const *) &addr)->sun_path;
+      if (lstat(path,&sb) == 0 && S_ISSOCK(sb.st_mode))
+	 unlink(path);
+   } else
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+   if (bind(fd, (struct sockaddr const *) &addr, sys_addr_len(&addr)) < 0) {
+      Message(MSG_W,Msg::addr_unusable(sys_addr2str(&addr),errno));
       close(fd);
       return false;
    }
-   if (listen(fd, 5) < 0)
+   if (addr.ss_family == AF_UNIX)		// Zugriffsschutz über SO_PEERCRED und Token
+      chmod(((struct sockaddr_un const *) &addr)->sun_path,0666);
+   if (listen(fd, LISTEN_BACKLOG) < 0) {
       YUFTL(G20,syscall_failed("listen",0));
-   else
-      new TcpServer(fd);
+      close(fd);
+      return false;
+   }
+   new TcpServer(fd);
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// TCP-Socket und ggf. Unix-Socket öffnen
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TcpServer::init()
+{
+   if (!listen_on(my_addr))
+      return false;
+   struct sockaddr_storage su;
+   if (!my_unix_path.empty()) {
+      if (!sys_unix_addr(&su,my_unix_path))
+	 Message(MSG_W,Msg::addr_unusable(my_unix_path,ENAMETOOLONG));
+      else if (listen_on(su))
+	 Message(MSG_1,"Unix-Socket %s",(const char *) my_unix_path);
+   }
    return true;
 }
 
@@ -625,23 +1059,40 @@ class ServerCfgReader: public CfgReader
 {
 public:
    ServerCfgReader(const char *fn, int prio): CfgReader(fn,prio) {}
-   bool host(const char *name, struct sockaddr_in const *sa, int max_jobs, int prio,
-	 const char *cfg);
+   bool host(const char *name, struct sockaddr_storage const *sa, int max_jobs, int prio,
+	 const char *cfg, const char *unix_path);
+   bool user(const char *name, UserCfg const &uc);
 };
 
 
 
-bool ServerCfgReader::host(const char *name, struct sockaddr_in const *sa, int max_jobs, int prio,
-	 const char *cfg)
+bool ServerCfgReader::host(const char *name, struct sockaddr_storage const *sa, int max_jobs, int prio,
+	 const char *cfg, const char *unix_path)
 {
    if (sa != 0 && !strcmp(name, my_hostname())) {	// Server-Zeile mit unserem Namen
       max_active = max_jobs > 0 ? max_jobs : 1;
       my_addr = *sa;
+      my_unix_path = unix_path ? unix_path : "";
    }
    return true;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Zeile im Abschnitt !users: Anteil, Höchstzahl und nice-Werte für einen Benutzer, «*» für alle
+// anderen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ServerCfgReader::user(const char *name, UserCfg const &uc)
+{
+   if (!strcmp(name,"*"))
+      default_user = uc;
+   else
+      User::get(name)->cfg_ = uc;
+   return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Konfigurationsdatei lesen
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -668,10 +1119,8 @@ static bool load_cfg()
 static void handle_exit(pid_t pid, int status)
 {
    SrvJob *j = SrvJob::find_pid(pid);
-   if (j != 0) {
-      j->handle_exit(pid,status);
+   if (j != 0 && !j->handle_exit(pid,status))
       delete j;
-   }
 }
 
 
@@ -787,7 +1236,8 @@ static bool init(int argc, char *argv[])
       daemon();
       openlog("yabusrv",0,LOG_USER);
       set_message_handler(to_syslog);
-   }
+   } else
+      setvbuf(stdout,0,_IOLBF,0);	// Protokoll zeilenweise, auch in eine Datei
 
    set_language();
    struct stat sb;
@@ -804,6 +1254,7 @@ static bool init(int argc, char *argv[])
       return false;
    if (!TcpServer::init())
       return false;
+   PollObj::watch_children();
 
    return true;
 }
@@ -814,15 +1265,22 @@ int server_main(int argc, char *argv[])
    if (!init(argc, argv))
       return 2;
 
-   Message(MSG_0,Msg::server_running(YABU_VERSION, addr2str(my_addr)));
+   Message(MSG_0,Msg::server_running(YABU_VERSION, sys_addr2str(&my_addr)));
    while (exit_code < 2) {
-      PollObj::poll(10000);
+      // SIGCHLD weckt «poll()» über «PollObj::watch_children()» sofort auf, beendete Skripte
+      // melden wir also ohne Verzögerung. Der Timeout ist nur für Systeme ohne signalfd.
+      PollObj::poll(got_sigchld ? 0 : 10000);
       Client::purge();
-      int status;
-      pid_t pid;
-      while ((pid = waitpid(0,&status,WNOHANG)) != (pid_t) -1 && pid > 1)
-	 handle_exit(pid,status);
+      if (got_sigchld) {
+	 got_sigchld = false;
+	 int status;
+	 pid_t pid;
+	 // Die Skripte laufen in eigenen Prozeßgruppen, daher -1 statt 0
+	 while ((pid = waitpid(-1,&status,WNOHANG)) != (pid_t) -1 && pid > 1)
+	    handle_exit(pid,status);
+      }
       Client::start_jobs();
+      Client::advertise_all();
    }
    Message(MSG_0,"yabusrv exit(%d)",exit_code);
    return exit_code;
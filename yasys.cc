@@ -9,16 +9,25 @@
 #include "yabu.h"
 #include <fcntl.h>
 #include <netdb.h>
+#include <sched.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
 #include <utime.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/utsname.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#endif
 
 
 static struct utsname ubuf;
@@ -58,6 +67,120 @@ const char *my_hostname()
     return ubuf.nodename;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liest eine kleine Datei (z.B. aus /proc oder /sys) nach «buf». Der Inhalt wird mit NUL
+// abgeschlossen und gegebenenfalls abgeschnitten.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool sys_read_file(const char *fn, char *buf, size_t size)
+{
+   int const fd = yabu_open(fn,O_RDONLY);
+   if (fd < 0)
+      return false;
+   int const n = yabu_read(fd,buf,size - 1);
+   close(fd);
+   if (n <= 0)
+      return false;
+   buf[n] = 0;
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Monotone Zeit in Millisekunden (für Laufzeitmessungen, nicht für Zeitstempel).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned long sys_time_ms()
+{
+#ifdef CLOCK_MONOTONIC
+   struct timespec ts;
+   if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0)
+      return (unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+   return (unsigned long) time(0) * 1000;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Anzahl der für yabu nutzbaren CPUs. Unter Linux berücksichtigen wir die CPU-Affinität und eine
+// eventuelle CPU-Quote der cgroup (z.B. in Containern).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned sys_cpu_count()
+{
+   long n = 0;
+#if defined(__linux__) && defined(CPU_COUNT)
+   cpu_set_t set;
+   if (sched_getaffinity(0,sizeof(set),&set) == 0)
+      n = CPU_COUNT(&set);
+#endif
+#ifdef _SC_NPROCESSORS_ONLN
+   if (n <= 0)
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (n <= 0)
+      n = 1;
+
+#if defined(__linux__)
+   char buf[1000];
+   long quota = -1;
+   long period = 0;
+   Str fn("/sys/fs/cgroup");			// cgroup v2: Eintrag "0::<Pfad>"
+   if (sys_read_file("/proc/self/cgroup",buf,sizeof(buf))) {
+      char *c = strstr(buf,"0::");
+      if (c && (c == buf || c[-1] == '\n')) {
+	 char *e = strchr(c += 3,'\n');
+	 if (e) *e = 0;
+	 fn.append(c);
+      }
+   }
+   fn.append("/cpu.max");
+   if (sys_read_file(fn,buf,sizeof(buf)) || sys_read_file("/sys/fs/cgroup/cpu.max",buf,sizeof(buf))) {
+      if (sscanf(buf,"%ld %ld",&quota,&period) != 2)	// "max 100000": keine Quote
+	 quota = -1;
+   } else if (sys_read_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us",buf,sizeof(buf))) {
+      quota = atol(buf);				// cgroup v1
+      if (sys_read_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us",buf,sizeof(buf)))
+	 period = atol(buf);
+   }
+   if (quota > 0 && period > 0 && (quota + period - 1) / period < n)
+      n = (quota + period - 1) / period;
+#endif
+   return (unsigned) n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ermittelt die aktuelle Systemlast. Werte, die das System nicht liefert, sind negativ.
+//   load1	Mittlere Last der letzten Minute
+//   cpu_psi	Anteil der Zeit mit CPU-Mangel (PSI "some avg10", in %, nur Linux)
+//   mem_psi	Anteil der Zeit mit Speichermangel (PSI "some avg10", in %, nur Linux)
+//   mem_avail	Verfügbarer Speicher in MB (MemAvailable, nur Linux)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double psi_avg10(const char *fn)
+{
+   char buf[300];
+   const char *c;
+   if (!sys_read_file(fn,buf,sizeof(buf)) || (c = strstr(buf,"avg10=")) == 0)
+      return -1;
+   return atof(c + 6);
+}
+
+void sys_get_load(SysLoad *sl)
+{
+   double avg[1];
+   sl->load1 = getloadavg(avg,1) == 1 ? avg[0] : -1;
+   sl->cpu_psi = psi_avg10("/proc/pressure/cpu");
+   sl->mem_psi = psi_avg10("/proc/pressure/memory");
+   sl->mem_avail = -1;
+   char buf[2000];
+   const char *c;
+   if (sys_read_file("/proc/meminfo",buf,sizeof(buf)) && (c = strstr(buf,"MemAvailable:")) != 0)
+      sl->mem_avail = atol(c + 13) / 1024;
+}
+
+
 void set_close_on_exec(int fd)
 {
    long const old_flags = fcntl(fd,F_GETFD);
@@ -66,15 +189,126 @@ void set_close_on_exec(int fd)
 }
 
 
-bool resolve(struct in_addr *a, const char *name)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Erzeugt eine anonyme Datei im Hauptspeicher (memfd, nur Linux). Der Deskriptor hat FD_CLOEXEC
+// gesetzt und ist über «/proc/self/fd/<fd>» auch für andere Programme lesbar.
+// return: Deskriptor oder -1, falls nicht unterstützt (dann temporäre Datei benutzen).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int sys_memfd(const char *name)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+   static int usable = -1;			// /proc vorhanden?
+   if (usable < 0)
+      usable = access("/proc/self/fd",X_OK) == 0;
+   if (usable)
+      return memfd_create(name,MFD_CLOEXEC);
+#endif
+   return -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adresse «name» (Hostname, IPv4- oder IPv6-Adresse) mit Port «port» auflösen. Bei mehreren
+// Ergebnissen nehmen wir das erste, «getaddrinfo()» sortiert sie bereits nach RFC 3484.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool resolve(struct sockaddr_storage *sa, const char *name, const char *port)
+{
+   struct addrinfo hints;
+   memset(&hints,0,sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_NUMERICSERV;
+   struct addrinfo *ai = 0;
+   if (getaddrinfo(name,port,&hints,&ai) != 0 || ai == 0)
+      return false;
+   memset(sa,0,sizeof(*sa));
+   memcpy(sa,ai->ai_addr,ai->ai_addrlen);
+   freeaddrinfo(ai);
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adresse des Unix-Sockets «path». Return: false, wenn der Pfad zu lang ist.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool sys_unix_addr(struct sockaddr_storage *sa, const char *path)
 {
-    if ((a->s_addr = inet_addr(name)) == (in_addr_t) -1) {
-        struct hostent *he = gethostbyname(name);
-        if (he == 0)
-	    return false;
-        memcpy(&a->s_addr,he->h_addr_list[0],sizeof(a->s_addr));
-    }
-    return true;
+   struct sockaddr_un *const su = (struct sockaddr_un *) sa;
+   if (strlen(path) >= sizeof(su->sun_path))
+      return false;
+   memset(sa,0,sizeof(*sa));
+   su->sun_family = AF_UNIX;
+   strcpy(su->sun_path,path);
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Länge der Adresse für «bind()» und «connect()»
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned sys_addr_len(struct sockaddr_storage const *sa)
+{
+   switch (sa->ss_family) {
+      case AF_INET: return sizeof(struct sockaddr_in);
+      case AF_INET6: return sizeof(struct sockaddr_in6);
+      case AF_UNIX: return sizeof(struct sockaddr_un);
+   }
+   return sizeof(*sa);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Lesbare Darstellung einer Adresse («addr:port», «[addr6]:port» oder der Socket-Pfad)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *sys_addr2str(struct sockaddr_storage const *sa)
+{
+   static char buf[INET6_ADDRSTRLEN + 10];
+   char host[INET6_ADDRSTRLEN];
+   switch (sa->ss_family) {
+      case AF_INET: {
+	 struct sockaddr_in const *const si = (struct sockaddr_in const *) sa;
+	 inet_ntop(AF_INET,&si->sin_addr,host,sizeof(host));
+	 snprintf(buf,sizeof(buf),"%s:%u",host,ntohs(si->sin_port));
+	 return buf;
+      }
+      case AF_INET6: {
+	 struct sockaddr_in6 const *const si = (struct sockaddr_in6 const *) sa;
+	 inet_ntop(AF_INET6,&si->sin6_addr,host,sizeof(host));
+	 snprintf(buf,sizeof(buf),"[%s]:%u",host,ntohs(si->sin6_port));
+	 return buf;
+      }
+      case AF_UNIX: {
+	 struct sockaddr_un const *const su = (struct sockaddr_un const *) sa;
+	 return su->sun_path[0] ? su->sun_path : "unix";
+      }
+   }
+   return "?";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Socket-Optionen für TCP-Verbindungen. Datensätze sammelt «IoBuffer», deshalb kein Nagle.
+// Keepalive erkennt abgestürzte Rechner nach etwa zwei Minuten statt nach Stunden.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void sys_tune_socket(int fd, struct sockaddr_storage const *sa)
+{
+   if (sa->ss_family != AF_INET && sa->ss_family != AF_INET6)
+      return;
+   int yes = 1;
+   setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&yes,sizeof(yes));
+   setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&yes,sizeof(yes));
+#ifdef TCP_KEEPIDLE
+   int idle = 60, intvl = 10, cnt = 6;
+   setsockopt(fd,IPPROTO_TCP,TCP_KEEPIDLE,&idle,sizeof(idle));
+   setsockopt(fd,IPPROTO_TCP,TCP_KEEPINTVL,&intvl,sizeof(intvl));
+   setsockopt(fd,IPPROTO_TCP,TCP_KEEPCNT,&cnt,sizeof(cnt));
+#endif
 }
 
 
@@ -115,12 +349,41 @@ void sys_setup_sig_handler(yabu_sigh_t hup, yabu_sigh_t intr, yabu_sigh_t term)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liefert einen Deskriptor, der bei SIGCHLD lesbar wird (signalfd, nur Linux), oder -1. SIGCHLD wird
+// dann blockiert; Kindprozesse erhalten in «yabu_fork()» wieder die ursprüngliche Signalmaske.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static sigset_t orig_sigmask;		// Signalmaske vor «sys_sigchld_fd()»
+static bool sigmask_changed = false;
+
+int sys_sigchld_fd()
+{
+#if defined(__linux__) && defined(SFD_CLOEXEC)
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set,SIGCHLD);
+   int const fd = signalfd(-1,&set,SFD_NONBLOCK | SFD_CLOEXEC);
+   if (fd >= 0 && !sigmask_changed) {
+      sigprocmask(SIG_BLOCK,&set,&orig_sigmask);
+      sigmask_changed = true;
+   }
+   return fd;
+#else
+   return -1;
+#endif
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Erzeugt einen neuen Prozeß und eine Pipe zwischen dem aufrufenden und Kindprozeß.
 // Der Aufrufer erhält das Lese-Ende der Pipe in «pipe_fd». Das Schreib-Ende wird im Kindprozeß
 // gemäß «flags» genutzt:
 //   EXEC_COLLECT_OUTPUT    Standardausgabe wird in die Pipe umgeleitet
 //   EXEC_MERGE_STDERR      Zusätzlich wird stderr in die Pipe umgeleitet
+//   EXEC_NEW_PGRP          Der Kindprozeß erhält eine eigene Prozeßgruppe, siehe «sys_kill_group()».
+//                          Ist stdin ein Terminal, liest er stattdessen von /dev/null: Als
+//                          Hintergrundgruppe bekäme er beim Lesen SIGTTIN und bliebe stehen.
 //
 // pipe: Dateideskriptor der Pipe (Lese-Ende)
 // pid: Prozeß-Id
@@ -148,6 +411,18 @@ bool yabu_fork(int *pipe_fd, pid_t *pid, unsigned flags)
 	   return false;
 	case 0:					// Kindprozeß
            close(pfd[0]);			// yabu-Ende schließen
+	   if (sigmask_changed)
+	       sigprocmask(SIG_SETMASK,&orig_sigmask,0);
+	   if (flags & EXEC_NEW_PGRP) {
+	       setpgid(0,0);
+	       if (isatty(0)) {
+		  int const fd = open("/dev/null",O_RDONLY);
+		  if (fd > 0) {
+		     dup2(fd,0);
+		     close(fd);
+		  }
+	       }
+	   }
 	   if ((flags & EXEC_MERGE_STDERR) == 0)	// stderr -> stdout (???)
 	       dup2(1, 2);
 	   if ((flags & EXEC_COLLECT_OUTPUT) && pfd[1] != 1) {
@@ -159,11 +434,28 @@ bool yabu_fork(int *pipe_fd, pid_t *pid, unsigned flags)
 	   break;
 	default:				// yabu
 	   close(pfd[1]);		 	// Kind-Ende schließen
+	   if (flags & EXEC_NEW_PGRP)
+	       setpgid(*pid,*pid);		// Auch hier, sonst Wettlauf mit «sys_kill_group()»
    }
 
    return true;
 }
 
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sendet ein Signal an die Prozeßgruppe eines mit EXEC_NEW_PGRP gestarteten Kindprozesses, d.h.
+// auch an alle vom Skript gestarteten Programme. Falls es die Gruppe nicht gibt (z.B. weil der
+// Prozeß schon beendet ist), erhält nur der Prozeß selbst das Signal.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void sys_kill_group(pid_t pid, int sig)
+{
+   if (pid <= 1)
+      return;
+   if (kill(-pid,sig) < 0)
+      kill(pid,sig);
+}
+
 int yabu_open(const char *fn, int flags)
 {
    int rc;
@@ -26,6 +26,8 @@
 
 Target *Target::sel_head = 0;			// Für Phase 2 ausgewählte Ziele
 Target **Target::sel_tail = &sel_head;
+unsigned Target::n_sel_build = 0;
+unsigned Target::n_sel_done = 0;
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -37,7 +39,9 @@ Target::Target(Project *prj, const char *name)
      req_by_(0), older_than_(0), srcs_(0), tgts_(0), build_rule_(0),
      is_alias_(*name == '!'),	// hier NICHT den Fall "all" behandeln!
      rule_id_(0), rule_id_new_(0),
-     is_regular_file_(false), sel_next_(0), sel_prevp_(0), group_(0), next_in_group_(0)
+     duration_(0),
+     is_regular_file_(false), sel_next_(0), sel_prevp_(0), sel_counted_(false), group_(0), next_in_group_(0),
+     crit_path_(~0UL)
 {
 }
 
@@ -206,6 +210,10 @@ bool Target::end_select()
    YABU_ASSERT(status_ == SELECTING);
    Message(MSG_3,"%s: %s --> %s",name_,status_str(status_), status_str(SELECTED));
    status_ = SELECTED;
+   if (build_rule_ != 0 && !sel_counted_) {
+      sel_counted_ = true;
+      ++n_sel_build;
+   }
    return true;
 }
 
@@ -217,6 +225,10 @@ void Target::deselect(Status status)
 {
    Message(MSG_3,"%s: %s --> %s",name_,status_str(status_), status_str(status));
    status_ = status;
+   if (sel_counted_) {
+      sel_counted_ = false;
+      ++n_sel_done;
+   }
    if (sel_prevp_ != 0) {
       *sel_prevp_ = sel_next_;
       if (sel_next_)
@@ -319,6 +331,84 @@ bool Target::is_leaf()
 
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Merkt sich die Laufzeit des Build-Skripts (aus der Statusdatei oder nach erfolgreichem Build).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned long Target::total_duration = 0;
+unsigned Target::n_durations = 0;
+
+void Target::set_duration(unsigned ms)
+{
+   if (ms == 0) ms = 1;			// 0 bedeutet «unbekannt»
+   if (duration_ == 0) {
+      total_duration += ms;
+      ++n_durations;
+   } else
+      total_duration += ms - duration_;
+   duration_ = ms;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Erwartete Laufzeit des Build-Skripts in ms: die zuletzt gemessene oder, falls unbekannt, der
+// Mittelwert aller bekannten Laufzeiten. 0, wenn das Ziel kein Skript hat oder gar keine Laufzeiten
+// bekannt sind.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned long Target::expected_duration() const
+{
+   if (duration_ > 0)
+      return duration_;
+   if (build_rule_ == 0 || n_durations == 0)
+      return 0;
+   return total_duration / n_durations;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Länge des längsten Pfades von diesem Ziel zu einem Endziel in ms, d.h. die Laufzeit des eigenen
+// Skripts plus der längste Pfad über alle ausgewählten Ziele, die davon abhängen. Ist keine
+// Laufzeit bekannt, zählt jedes Skript mit dem Mittelwert der bekannten Laufzeiten (bzw. 1, wenn
+// es gar keine gibt), das Ergebnis ist dann die Tiefe des Abhängigkeitsbaums.
+// Der Wert wird nur einmal berechnet.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned long Target::critical_path()
+{
+   if (crit_path_ != ~0UL)
+      return crit_path_;
+   crit_path_ = 0;			// Schutz gegen Zyklen
+   unsigned long max = 0;
+   for (Dependency const *d = tgts_; d; d = d->next_tgt_) {
+      Target *const t = d->tgt_;
+      if (d->deleted_ || t->status_ < SELECTING || t->status_ > BUILDING)
+	 continue;			// Wird in diesem Lauf nicht erzeugt
+      unsigned long const cp = t->critical_path();
+      if (cp > max) max = cp;
+   }
+   unsigned long own = expected_duration();
+   if (own == 0 && build_rule_ != 0)
+      own = 1;
+   crit_path_ = own + max;
+   return crit_path_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Anzahl der Ziele, die direkt von diesem Ziel abhängen.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned Target::fan_out() const
+{
+   unsigned n = 0;
+   for (Dependency const *d = tgts_; d; d = d->next_tgt_) {
+      if (!d->deleted_) ++n;
+   }
+   return n;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Status auf BUILDING setzen
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -448,6 +538,105 @@ void Target::set_group(Rule *r, StringList const &args)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Konstruktor
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Pool *Pool::head = 0;			// Liste aller Pools
+
+Pool::Pool(const char *name, unsigned capacity)
+   : name_(name), capacity_(capacity), next_(head), weights_(0), used_(0), n_used_(0)
+{
+   head = this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Erzeugt einen neuen Pool oder ändert die Kapazität des bestehenden Pools «name».
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Pool *Pool::create(const char *name, unsigned capacity)
+{
+   Pool *p;
+   for (p = head; p && strcmp(p->name_,name); p = p->next_);
+   if (p == 0)
+      p = new Pool(str_freeze(name),capacity);
+   p->capacity_ = capacity;
+   return p;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fügt Muster mit dem Gewicht «weight» hinzu.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Pool::add(unsigned weight, StringList &tgts)
+{
+   for (size_t i = 0; i < tgts.size(); ++i) {
+      tgts_.append(tgts[i]);
+      array_realloc(weights_,tgts_.size());
+      weights_[tgts_.size() - 1] = weight;
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Liefert die Pools, die ein Ziel belegt, mit Gewicht (Liste endet mit «pool_» = 0), oder 0, falls
+// das Ziel zu keinem Pool gehört. Pro Pool gilt das erste passende Muster. Der Aufrufer gibt die
+// Liste mit «free()» frei.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PoolUse *Pool::lookup(const char *tgt)
+{
+   PoolUse *uses = 0;
+   size_t n = 0;
+   StringList dummy;
+   for (Pool *p = head; p; p = p->next_) {
+      for (size_t i = 0; i < p->tgts_.size(); ++i) {
+	 if (dummy.match('%',p->tgts_[i],tgt)) {
+	    array_realloc(uses,n + 2);
+	    uses[n].pool_ = p;
+	    uses[n++].weight_ = p->weights_[i];
+	    uses[n].pool_ = 0;
+	    break;
+	 }
+      }
+   }
+   return uses;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prüft, ob in der Warteschlange «qid» noch Platz für «weight» ist. Ein Skript, dessen Gewicht
+// größer als die Kapazität ist, darf laufen, wenn der Pool ansonsten leer ist.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Pool::fits(unsigned qid, unsigned weight) const
+{
+   unsigned const used = qid < n_used_ ? used_[qid] : 0;
+   return used == 0 || used + weight <= capacity_;
+}
+
+
+void Pool::acquire(unsigned qid, unsigned weight)
+{
+   if (qid >= n_used_) {
+      array_realloc(used_,qid + 1);
+      while (n_used_ <= qid)
+	 used_[n_used_++] = 0;
+   }
+   used_[qid] += weight;
+}
+
+
+void Pool::release(unsigned qid, unsigned weight)
+{
+   YABU_ASSERT(qid < n_used_ && used_[qid] >= weight);
+   if (qid < n_used_)
+      used_[qid] -= weight;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Konstruktor (löscht «tgts»!)
 ////////////////////////////////////////////////////////////////////////////////////////////////////